@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arena.h"
+#include "stats.h"
+
+struct ArenaBlock
+{
+    ArenaBlock *next;
+    size_t size;   // Usable bytes after the header
+    size_t offset; // Bytes used so far
+};
+
+// Block header size rounded up so the payload starts aligned
+#define BLOCK_HEADER ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+static size_t aligned(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+void arenaInit(Arena *arena, size_t blockSize)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->blockSize = blockSize > BLOCK_HEADER ? blockSize - BLOCK_HEADER : 1024;
+}
+
+void *arenaAlloc(Arena *arena, size_t size)
+{
+    if (size > SIZE_MAX - 2 * ARENA_ALIGNMENT - BLOCK_HEADER)
+        return NULL;
+    size = aligned(size ? size : 1);
+
+    ArenaBlock *block = arena->blocks;
+    if (!block || block->size - block->offset < size)
+    {
+        size_t blockSize = size > arena->blockSize ? size : arena->blockSize;
+        block = statsMalloc(BLOCK_HEADER + blockSize);
+        if (!block)
+            return NULL;
+        block->size = blockSize;
+        block->offset = 0;
+        arena->reserved += BLOCK_HEADER + blockSize;
+
+        // An oversized block is filled by this one request, so it goes behind
+        // the current block and does not waste the current block's space.
+        if (size > arena->blockSize && arena->blocks)
+        {
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        }
+        else
+        {
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+
+    void *memory = (char *)block + BLOCK_HEADER + block->offset;
+    block->offset += size;
+    arena->used += size;
+    return memory;
+}
+
+void *arenaCalloc(Arena *arena, size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size)
+        return NULL;
+    void *memory = arenaAlloc(arena, count * size);
+    if (memory)
+        memset(memory, 0, count * size);
+    return memory;
+}
+
+void arenaReset(Arena *arena)
+{
+    // Keep the oldest block, which is always a regular sized one unless the
+    // arena only ever saw oversized requests
+    ArenaBlock *keep = NULL;
+    ArenaBlock *block = arena->blocks;
+    while (block)
+    {
+        ArenaBlock *next = block->next;
+        if (!next && block->size == arena->blockSize)
+            keep = block;
+        else
+            free(block);
+        block = next;
+    }
+
+    arena->blocks = keep;
+    arena->used = 0;
+    arena->reserved = keep ? BLOCK_HEADER + keep->size : 0;
+    if (keep)
+    {
+        keep->next = NULL;
+        keep->offset = 0;
+    }
+}
+
+void arenaFree(Arena *arena)
+{
+    ArenaBlock *block = arena->blocks;
+    while (block)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->used = 0;
+    arena->reserved = 0;
+}
+
+size_t arenaBytesUsed(const Arena *arena)
+{
+    return arena->used;
+}
+
+size_t arenaBytesReserved(const Arena *arena)
+{
+    return arena->reserved;
+}
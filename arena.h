@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Region allocator. Allocations are carved out of large blocks and are
+// never freed one by one; the whole arena is reset or freed at once, so
+// tearing down everything a session allocated costs one free per block.
+
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena
+{
+    ArenaBlock *blocks; // Current block first
+    size_t blockSize;   // Size of regular blocks, bigger requests get their own
+    size_t used;        // Bytes handed out since the last reset
+    size_t reserved;    // Bytes of all blocks together
+} Arena;
+
+// Prepare an empty arena. Nothing is allocated until the first arenaAlloc.
+void arenaInit(Arena *arena, size_t blockSize);
+
+// Allocate size bytes aligned to ARENA_ALIGNMENT, NULL if memory runs out
+void *arenaAlloc(Arena *arena, size_t size);
+
+// Allocate zeroed memory for count elements of the given size
+void *arenaCalloc(Arena *arena, size_t count, size_t size);
+
+// Forget every allocation but keep the first block for reuse
+void arenaReset(Arena *arena);
+
+// Release every block
+void arenaFree(Arena *arena);
+
+// Bytes handed out and bytes held from the system
+size_t arenaBytesUsed(const Arena *arena);
+size_t arenaBytesReserved(const Arena *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,13 @@
+#ifndef BAKED_H
+#define BAKED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The stock dungeon (dungeon.txt), compiled into the program at build time
+// by "dunc -c bakedDungeon" as a static read-only dungeon file image. See
+// dungeonOpenMemory and dungeonSetBuiltin.
+extern const uint64_t bakedDungeon[];
+extern const size_t bakedDungeonSize;
+
+#endif // BAKED_H
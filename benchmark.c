@@ -0,0 +1,233 @@
+// benchmark - microbenchmarks of the game engine
+//
+// Usage: benchmark [-d dungeon-file] [-w width] [-h height] [-t seconds]
+//
+// Times the engine's hot paths on three worlds: "stock", the dungeon file
+// (dungeon.dat by default), "builtin", the stock dungeon compiled into the
+// program, and "large", a generated width x height grid (1000 x 1000 by
+// default) written to a temporary file. On the large world
+// a tick of one million wandering creatures is timed as well, so its ns/op
+// is the cost per tick per million creatures. Each benchmark runs
+// for at least the given time (0.2 s by default) with a doubling number of
+// iterations and reports the time per operation.
+//
+// One line per benchmark, in a format that stays the same between builds
+// so runs can be compared with diff or benchstat:
+//
+//   Benchmark<Name>/<world> <iterations> <ns> ns/op
+//
+// Game output is captured in memory and dropped after every operation, so
+// the formatting is timed but nothing is written.
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "baked.h"
+#include "hwdec12.h"
+#include "entities.h"
+#include "generate.h"
+
+#define TICK_ENTITIES 1000000
+
+typedef struct Bench
+{
+    Dungeon *dungeon;
+    GameState *game;
+    Entities *entities;
+    const char *dungeonPath;
+    const char *snapshotPath;
+    int creatureRoom; // Room of the first creature, -1 if none
+    char command[32];
+} Bench;
+
+typedef void (*BenchFunction)(Bench *bench);
+
+static double minSeconds = 0.2;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void benchLoadRooms(Bench *bench)
+{
+    Dungeon dungeon;
+    if (loadRooms(&dungeon, bench->dungeonPath) == 0)
+        dungeonClose(&dungeon);
+}
+
+static void benchSaveLoad(Bench *bench)
+{
+    save(bench->game, bench->snapshotPath);
+    load(bench->game, bench->snapshotPath);
+    sinkReset(&bench->game->out);
+}
+
+static void benchDispatch(Bench *bench)
+{
+    // Every command is tried before an unknown one is rejected
+    strcpy(bench->command, "xyzzy");
+    handleCommand(bench->game, bench->command);
+    sinkReset(&bench->game->out);
+}
+
+static void benchLook(Bench *bench)
+{
+    look(bench->game);
+    sinkReset(&bench->game->out);
+}
+
+static void benchAttack(Bench *bench)
+{
+    // A fresh creature and player every time
+    GameState *game = bench->game;
+    RoomState *state = roomTableGet(&game->rooms, bench->creatureRoom);
+    if (state)
+        state->creatureDamage = 0;
+    game->player.health = PLAYER_HEALTH;
+    game->player.currentRoom = bench->creatureRoom;
+    attack(game);
+    sinkReset(&game->out);
+}
+
+static void benchAttackBrief(Bench *bench)
+{
+    bench->game->briefFights = 1;
+    benchAttack(bench);
+    bench->game->briefFights = 0;
+}
+
+static void benchTick(Bench *bench)
+{
+    TickResult result;
+    entitiesTick(bench->entities, bench->dungeon, bench->game->player.currentRoom, &result);
+}
+
+static void run(const char *name, const char *world, BenchFunction function, Bench *bench)
+{
+    long iterations = 1;
+    double elapsed;
+    for (;;)
+    {
+        double start = now();
+        for (long i = 0; i < iterations; i++)
+            function(bench);
+        elapsed = now() - start;
+        if (elapsed >= minSeconds || iterations >= (1L << 40))
+            break;
+        // Aim a little past the target so the next round is the last
+        double scale = elapsed > 0 ? 1.2 * minSeconds / elapsed : 100;
+        iterations = (long)(iterations * (scale < 2 ? 2 : scale > 100 ? 100 : scale));
+    }
+    printf("Benchmark%s/%s %ld %.1f ns/op\n", name, world, iterations, elapsed * 1e9 / iterations);
+    fflush(stdout);
+}
+
+static int benchWorld(const char *world, const char *dungeonPath, const char *snapshotPath)
+{
+    Dungeon dungeon;
+    GameState game;
+    if (loadRooms(&dungeon, dungeonPath) != 0)
+        return -1;
+    memset(&game, 0, sizeof(game));
+    sinkInit(&game.out, SINK_CAPTURE, -1);
+    if (newGame(&game, &dungeon) != 0)
+    {
+        dungeonClose(&dungeon);
+        return -1;
+    }
+
+    Bench bench = {&dungeon, &game, NULL, dungeonPath, snapshotPath, -1, ""};
+    for (int room = 0; room < dungeon.roomCount && bench.creatureRoom < 0; room++)
+    {
+        const DungeonRoom *r = dungeonRoom(&dungeon, room);
+        if (r->creature != 0 && r->creatureHealth > 0)
+            bench.creatureRoom = room;
+    }
+
+    run("LoadRooms", world, benchLoadRooms, &bench);
+    run("SaveLoad", world, benchSaveLoad, &bench);
+    run("Dispatch", world, benchDispatch, &bench);
+    run("Look", world, benchLook, &bench);
+    if (bench.creatureRoom >= 0)
+    {
+        run("Attack", world, benchAttack, &bench);
+        run("AttackBrief", world, benchAttackBrief, &bench);
+    }
+
+    Entities entities;
+    if (dungeon.roomCount >= TICK_ENTITIES && entitiesInit(&entities, TICK_ENTITIES) == 0)
+    {
+        entitiesPopulate(&entities, &dungeon, TICK_ENTITIES, 1);
+        bench.entities = &entities;
+        run("Tick1M", world, benchTick, &bench);
+        entitiesFree(&entities);
+    }
+
+    freeResources(&game);
+    sinkFree(&game.out);
+    dungeonClose(&dungeon);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dungeonPath = DEFAULT_DUNGEON;
+    dungeonSetBuiltin(bakedDungeon, bakedDungeonSize);
+    GeneratorConfig config;
+    generatorDefaults(&config);
+    config.width = 1000;
+    config.height = 1000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            dungeonPath = argv[++i];
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            config.width = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc)
+            config.height = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            minSeconds = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-d dungeon-file] [-w width] [-h height] [-t seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    char largePath[] = "/tmp/benchmark-XXXXXX";
+    char snapshotPath[] = "/tmp/benchmark-save-XXXXXX";
+    int largeFd = mkstemp(largePath);
+    int snapshotFd = mkstemp(snapshotPath);
+    if (largeFd < 0 || snapshotFd < 0)
+    {
+        fprintf(stderr, "Cannot create temporary files.\n");
+        return 1;
+    }
+    close(largeFd);
+    close(snapshotFd);
+
+    DungeonImage image;
+    int failed = 1;
+    if (dungeonGenerate(&config, &image) != 0)
+        fprintf(stderr, "Cannot generate a %d x %d dungeon.\n", config.width, config.height);
+    else
+    {
+        failed = dungeonWrite(largePath, &image) != 0;
+        dungeonImageFree(&image);
+    }
+
+    if (!failed)
+        failed = benchWorld("stock", dungeonPath, snapshotPath) != 0 ||
+                 benchWorld("builtin", BUILTIN_DUNGEON, snapshotPath) != 0 ||
+                 benchWorld("large", largePath, snapshotPath) != 0;
+
+    unlink(largePath);
+    unlink(snapshotPath);
+    return failed;
+}
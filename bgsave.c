@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bgsave.h"
+#include "hwdec12.h"
+#include "snapshot.h"
+#include "stats.h"
+
+#define MAX_ORPHANS 64 // Saves still running after their session ended
+
+// What the child writes to the pipe before it exits
+typedef struct Report
+{
+    int32_t result;
+    uint32_t reserved;
+    uint64_t writeNs;
+} Report;
+
+// Children of ended sessions, reaped by whichever session polls, starts or
+// frees a save next. Shards of the server end sessions on several threads,
+// so slots are claimed and cleared atomically. orphanCount lets the poll
+// before every command skip the table while it is empty.
+static pid_t orphans[MAX_ORPHANS];
+static int orphanCount;
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void reapOrphans(void)
+{
+    if (__atomic_load_n(&orphanCount, __ATOMIC_RELAXED) == 0)
+        return;
+    for (int i = 0; i < MAX_ORPHANS; i++)
+    {
+        pid_t pid = __atomic_load_n(&orphans[i], __ATOMIC_RELAXED);
+        if (pid <= 0)
+            continue;
+        pid_t done = waitpid(pid, NULL, WNOHANG);
+        if ((done == pid || (done < 0 && errno == ECHILD)) &&
+            __atomic_compare_exchange_n(&orphans[i], &pid, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            __atomic_sub_fetch(&orphanCount, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Runs in the child. The parent may have other threads, so only
+// async-signal-safe calls are made here: no malloc, no stdio.
+static void writeChild(int fd, const char *temporary, const char *path, const unsigned char *buffer,
+                       size_t size, int reportFd)
+{
+    Report report = {-1, 0, 0};
+    uint64_t begin = nowNs();
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t n = write(fd, buffer + written, size - written);
+        if (n <= 0)
+            break;
+        written += (size_t)n;
+    }
+    if (close(fd) == 0 && written == size && rename(temporary, path) == 0)
+        report.result = 0;
+    else
+        unlink(temporary);
+    report.writeNs = nowNs() - begin;
+
+    // The child must not flush stdio buffers it shares with the parent or
+    // run its exit handlers, hence _exit
+    ssize_t sent = write(reportFd, &report, sizeof(report));
+    _exit(sent == (ssize_t)sizeof(report) && report.result == 0 ? 0 : 1);
+}
+
+int backgroundSaveStart(BackgroundSave *save, const GameState *game, const char *path)
+{
+    if (save->pid > 0)
+        return 1;
+
+    free(save->path);
+    save->path = statsStrdup(path);
+    if (!save->path)
+        return -1;
+
+    // Everything the child needs is prepared here: encoding allocates, and
+    // the child of a threaded process may not
+    uint64_t start = nowNs();
+    unsigned char *buffer;
+    size_t size;
+    if (snapshotEncode(game, &buffer, &size) != 0)
+        return -1;
+    char *temporary;
+    int fd = snapshotTemporaryFile(path, &temporary);
+    int fds[2];
+    if (fd >= 0 && pipe2(fds, O_CLOEXEC) != 0)
+    {
+        close(fd);
+        unlink(temporary);
+        free(temporary);
+        fd = -1;
+    }
+    if (fd < 0)
+    {
+        free(buffer);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        writeChild(fd, temporary, path, buffer, size, fds[1]);
+    }
+
+    close(fd);
+    close(fds[1]);
+    free(buffer);
+    if (pid < 0)
+    {
+        close(fds[0]);
+        unlink(temporary);
+        free(temporary);
+        return -1;
+    }
+    free(temporary);
+    save->pid = pid;
+    save->pipe = fds[0];
+    save->pauseNs = nowNs() - start;
+    return 0;
+}
+
+int backgroundSavePoll(BackgroundSave *save, int wait, BackgroundSaveResult *result)
+{
+    reapOrphans();
+    if (save->pid <= 0)
+        return 0;
+
+    int status;
+    pid_t done;
+    do
+        done = waitpid(save->pid, &status, wait ? 0 : WNOHANG);
+    while (done < 0 && errno == EINTR);
+    if (done == 0)
+        return 0;
+
+    Report report;
+    memset(&report, 0, sizeof(report));
+    int complete = read(save->pipe, &report, sizeof(report)) == (ssize_t)sizeof(report);
+    close(save->pipe);
+    save->pid = 0;
+
+    result->failed = done < 0 || !complete || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    result->pauseNs = save->pauseNs;
+    result->writeNs = report.writeNs;
+    result->path = save->path;
+    return 1;
+}
+
+int backgroundSaveRunning(const BackgroundSave *save, const char *path)
+{
+    return save->pid > 0 && save->path && strcmp(save->path, path) == 0;
+}
+
+void backgroundSaveFree(BackgroundSave *save)
+{
+    // A save still running is left to finish on its own and reaped later,
+    // so ending a session never waits for the disk
+    BackgroundSaveResult result;
+    if (save->pid > 0 && !backgroundSavePoll(save, 0, &result))
+    {
+        close(save->pipe);
+        // Counted first, so a reaper never skips a parked child
+        __atomic_add_fetch(&orphanCount, 1, __ATOMIC_RELAXED);
+        int parked = 0;
+        for (int i = 0; i < MAX_ORPHANS && !parked; i++)
+        {
+            pid_t empty = 0;
+            parked = __atomic_compare_exchange_n(&orphans[i], &empty, save->pid, 0, __ATOMIC_RELAXED,
+                                                 __ATOMIC_RELAXED);
+        }
+        if (!parked)
+        {
+            __atomic_sub_fetch(&orphanCount, 1, __ATOMIC_RELAXED);
+            waitpid(save->pid, NULL, 0);
+        }
+    }
+    reapOrphans();
+    free(save->path);
+    memset(save, 0, sizeof(*save));
+}
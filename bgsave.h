@@ -0,0 +1,53 @@
+#ifndef BGSAVE_H
+#define BGSAVE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Background saves. The game encodes the session's snapshot in memory and
+// forks; the child writes it out and renames it into place while the
+// parent goes on handling commands. The game only waits for the encoding,
+// a copy of what the session changed, and the fork, never for the disk.
+// The child of the threaded server may only make async-signal-safe calls,
+// so it does nothing but write, rename and exit. It reports its result and
+// how long it took through a pipe; the parent collects it without blocking
+// the next time it polls.
+//
+// One background save per session runs at a time. A session that ends
+// while its save runs leaves the child to be reaped later.
+
+struct GameState;
+
+typedef struct BackgroundSave
+{
+    pid_t pid;        // Child writing the snapshot, 0 when none runs
+    int pipe;         // Read end of the child's report
+    uint64_t pauseNs; // Time the game was held up encoding and forking
+    char *path;       // Where the snapshot goes, malloc'd
+} BackgroundSave;
+
+// Outcome of a finished background save
+typedef struct BackgroundSaveResult
+{
+    int failed;
+    uint64_t pauseNs; // Time the game was held up encoding and forking
+    uint64_t writeNs; // Time the child took to write
+    const char *path; // Valid until the next save starts
+} BackgroundSaveResult;
+
+// Start saving game to path in a child process. Returns 0 if the save
+// started, 1 if one is already running and -1 if it could not start.
+int backgroundSaveStart(BackgroundSave *save, const struct GameState *game, const char *path);
+
+// Check for a finished save without blocking, or wait for it if wait is
+// set. Returns 1 and fills result when a save finished, 0 otherwise.
+int backgroundSavePoll(BackgroundSave *save, int wait, BackgroundSaveResult *result);
+
+// Whether a save to path is still running. The file must not be saved
+// or loaded meanwhile: the child renames its snapshot over it at the end.
+int backgroundSaveRunning(const BackgroundSave *save, const char *path);
+
+// Release everything held, without waiting for a running save
+void backgroundSaveFree(BackgroundSave *save);
+
+#endif // BGSAVE_H
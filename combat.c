@@ -0,0 +1,96 @@
+#include <limits.h>
+#include "combat.h"
+
+// Hits needed to bring health down to 0 or below: ceil(health / damage),
+// or INT_MAX if the damage does nothing
+static int hitsToKill(int health, int damage)
+{
+    if (damage <= 0)
+        return INT_MAX;
+    return health <= 0 ? 0 : (int)(((int64_t)health + damage - 1) / damage);
+}
+
+CombatResult combatResolve(int playerHealth, int playerStrength, int creatureHealth, int creatureDamage)
+{
+    CombatResult result;
+    result.playerWon = 0;
+    result.rounds = 0;
+    result.playerHealth = playerHealth;
+    result.creatureHealth = creatureHealth;
+    if (playerHealth <= 0 || creatureHealth <= 0)
+    {
+        result.playerWon = playerHealth > 0;
+        return result;
+    }
+
+    // The player lands a hit every round; the creature hits back in every
+    // round it survives. The player wins if the creature falls before it
+    // has struck playerHits times.
+    int creatureHits = hitsToKill(creatureHealth, playerStrength);
+    int playerHits = hitsToKill(playerHealth, creatureDamage);
+    if (creatureHits == INT_MAX && playerHits == INT_MAX)
+        return result;
+    result.playerWon = creatureHits <= playerHits;
+    result.rounds = result.playerWon ? creatureHits : playerHits;
+    int strikes = result.playerWon ? creatureHits - 1 : playerHits;
+    result.playerHealth = (int)(playerHealth - (int64_t)strikes * creatureDamage);
+    result.creatureHealth = (int)(creatureHealth - (int64_t)result.rounds * playerStrength);
+    return result;
+}
+
+// Branch-free ceil(health / damage) for health and damage in
+// (0, COMBAT_BATCH_LIMIT). Double division vectorizes where integer
+// division does not, and in that range the rounded quotient is off by at
+// most one, which the last two lines fix.
+static inline int32_t hitsFor(int32_t health, int32_t damage)
+{
+    int32_t hits = (int32_t)((double)health / (double)damage);
+    hits -= hits * damage > health;
+    hits += hits * damage < health;
+    return hits;
+}
+
+// The kernel of combatResolveBatch, same rules as combatResolve. The
+// buffers are parameters so that restrict tells the compiler they never
+// overlap.
+static void resolveAll(uint32_t count, int32_t *restrict playerHealth, const int32_t *restrict playerStrength,
+                       int32_t *restrict creatureHealth, const int32_t *restrict creatureDamage,
+                       int32_t *restrict rounds, int32_t *restrict playerWon)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int32_t health = playerHealth[i];
+        int32_t strength = playerStrength[i];
+        int32_t creature = creatureHealth[i];
+        int32_t damage = creatureDamage[i];
+
+        // Fights that cannot start, or that nobody can win, take no rounds
+        int32_t alive = (health > 0) & (creature > 0);
+        int32_t canHit = strength > 0;
+        int32_t canBeHit = damage > 0;
+        int32_t fights = alive & (canHit | canBeHit);
+
+        // Divide by clamped values everywhere and mask afterwards: a
+        // division left conditional would keep the loop from vectorizing
+        int32_t creatureHits = hitsFor(creature > 0 ? creature : 1, strength > 0 ? strength : 1);
+        int32_t playerHits = hitsFor(health > 0 ? health : 1, damage > 0 ? damage : 1);
+        creatureHits = (creatureHits & -canHit) | (INT32_MAX & (canHit - 1));
+        playerHits = (playerHits & -canBeHit) | (INT32_MAX & (canBeHit - 1));
+        int32_t won = creatureHits <= playerHits;
+        int32_t fought = (creatureHits & -won) | (playerHits & (won - 1));
+        int32_t strikes = fought - won;
+
+        // Conditions are 0 or 1, and -fights masks what a fight changes
+        int32_t mask = -fights;
+        rounds[i] = fought & mask;
+        playerHealth[i] = health - ((int32_t)((uint32_t)strikes * (uint32_t)damage) & mask);
+        creatureHealth[i] = creature - ((int32_t)((uint32_t)fought * (uint32_t)strength) & mask);
+        playerWon[i] = (won & fights) | ((health > 0) & (alive ^ 1));
+    }
+}
+
+void combatResolveBatch(const CombatBatch *batch)
+{
+    resolveAll(batch->count, batch->playerHealth, batch->playerStrength, batch->creatureHealth,
+               batch->creatureDamage, batch->rounds, batch->playerWon);
+}
@@ -0,0 +1,44 @@
+#ifndef COMBAT_H
+#define COMBAT_H
+
+#include <stdint.h>
+
+// Damage a creature deals per round
+#define CREATURE_DAMAGE 5
+
+// Outcome of a fight to the death, as attack() plays it out: the player
+// hits first, the creature hits back as long as it is alive. Outcomes are
+// computed in closed form, so a fight costs the same however many rounds
+// it lasts. A fight in which neither side can hurt the other ends at once
+// without a winner.
+typedef struct CombatResult
+{
+    int playerWon;
+    int rounds;          // Hits the player landed
+    int playerHealth;    // Player health after the fight
+    int creatureHealth;  // Creature health after the fight
+} CombatResult;
+
+// Resolve a fight without any output
+CombatResult combatResolve(int playerHealth, int playerStrength, int creatureHealth, int creatureDamage);
+
+// Many fights resolved at once, one array per attribute (structure of
+// arrays). Health is updated in place. The kernel has no branches, so it
+// compiles to SIMD loops; results equal combatResolve for health, strength
+// and damage below COMBAT_BATCH_LIMIT.
+#define COMBAT_BATCH_LIMIT (1 << 26)
+
+typedef struct CombatBatch
+{
+    int32_t *playerHealth;         // Before the fight, then after it
+    const int32_t *playerStrength;
+    int32_t *creatureHealth;       // Before the fight, then after it
+    const int32_t *creatureDamage;
+    int32_t *rounds;               // Hits the player landed
+    int32_t *playerWon;            // 1 or 0
+    uint32_t count;
+} CombatBatch;
+
+void combatResolveBatch(const CombatBatch *batch);
+
+#endif // COMBAT_H
@@ -0,0 +1,147 @@
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h> // For strncasecmp()
+#include "command.h"
+
+#define VERB_TABLE_SIZE 64 // Power of two, at least twice the verbs
+
+typedef struct KindInfo
+{
+    const char *name;
+    const char *argument;
+    int flags;
+} KindInfo;
+
+static const KindInfo kinds[CMD_KIND_COUNT] = {
+    [CMD_MOVE] = {"move", "direction", COMMAND_ARGUMENT},
+    [CMD_GOTO] = {"goto", "room", COMMAND_ARGUMENT},
+    [CMD_LOOK] = {"look", "", COMMAND_READ_ONLY},
+    [CMD_MAP] = {"map", "", COMMAND_READ_ONLY},
+    [CMD_INVENTORY] = {"inventory", "", COMMAND_READ_ONLY},
+    [CMD_PICKUP] = {"pickup", "item", COMMAND_ARGUMENT},
+    [CMD_ATTACK] = {"attack", "", 0},
+    [CMD_SAVE] = {"save", "filepath", COMMAND_ARGUMENT | COMMAND_READ_ONLY},
+    [CMD_BGSAVE] = {"bgsave", "filepath", COMMAND_ARGUMENT | COMMAND_READ_ONLY},
+    [CMD_LOAD] = {"load", "filepath", COMMAND_ARGUMENT},
+    [CMD_EXPORT] = {"export", "filepath", COMMAND_ARGUMENT | COMMAND_READ_ONLY},
+    [CMD_FIGHTS] = {"fights", "brief|full", COMMAND_ARGUMENT},
+    [CMD_HELP] = {"help", "", COMMAND_READ_ONLY},
+    [CMD_STATS] = {"stats", "", COMMAND_READ_ONLY},
+    [CMD_QUIT] = {"quit", "", COMMAND_READ_ONLY},
+    [CMD_UNKNOWN] = {"unknown", "", COMMAND_READ_ONLY},
+};
+
+typedef struct Verb
+{
+    const char *name;
+    int kind;
+} Verb;
+
+// Other names of the commands, besides their own
+static const Verb aliases[] = {
+    {"go", CMD_MOVE},
+    {"walk", CMD_MOVE},
+    {"travel", CMD_GOTO},
+    {"l", CMD_LOOK},
+    {"m", CMD_MAP},
+    {"i", CMD_INVENTORY},
+    {"inv", CMD_INVENTORY},
+    {"get", CMD_PICKUP},
+    {"take", CMD_PICKUP},
+    {"fight", CMD_ATTACK},
+    {"kill", CMD_ATTACK},
+    {"?", CMD_HELP},
+    {"exit", CMD_QUIT},
+    {"q", CMD_QUIT},
+};
+#define ALIAS_COUNT (int)(sizeof(aliases) / sizeof(aliases[0]))
+
+static Verb table[VERB_TABLE_SIZE]; // Open addressing, empty slots have no name
+static pthread_once_t tableOnce = PTHREAD_ONCE_INIT;
+
+static uint32_t hashVerb(const char *verb, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)tolower((unsigned char)verb[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void addVerb(const char *name, int kind)
+{
+    uint32_t slot = hashVerb(name, strlen(name)) & (VERB_TABLE_SIZE - 1);
+    while (table[slot].name)
+        slot = (slot + 1) & (VERB_TABLE_SIZE - 1);
+    table[slot].name = name;
+    table[slot].kind = kind;
+}
+
+static void buildTable(void)
+{
+    for (int kind = 0; kind < CMD_UNKNOWN; kind++)
+        addVerb(kinds[kind].name, kind);
+    for (int i = 0; i < ALIAS_COUNT; i++)
+        addVerb(aliases[i].name, aliases[i].kind);
+}
+
+static int findVerb(const char *verb, size_t length)
+{
+    pthread_once(&tableOnce, buildTable);
+    for (uint32_t slot = hashVerb(verb, length) & (VERB_TABLE_SIZE - 1); table[slot].name;
+         slot = (slot + 1) & (VERB_TABLE_SIZE - 1))
+    {
+        if (strncasecmp(table[slot].name, verb, length) == 0 && table[slot].name[length] == '\0')
+            return table[slot].kind;
+    }
+    return CMD_UNKNOWN;
+}
+
+const char *commandKindName(int kind)
+{
+    if (kind < 0 || kind >= CMD_KIND_COUNT)
+        return "";
+    return kinds[kind].name;
+}
+
+const char *commandArgumentName(int kind)
+{
+    if (kind < 0 || kind >= CMD_KIND_COUNT)
+        return "";
+    return kinds[kind].argument;
+}
+
+void parseCommand(char *line, ParsedCommand *command)
+{
+    char *verb = line;
+    while (isspace((unsigned char)*verb))
+        verb++;
+    char *end = verb;
+    while (*end && !isspace((unsigned char)*end))
+        end++;
+    size_t length = (size_t)(end - verb);
+
+    char *argument = end;
+    while (isspace((unsigned char)*argument))
+        argument++;
+    char *last = argument + strlen(argument);
+    while (last > argument && isspace((unsigned char)last[-1]))
+        last--;
+    *last = '\0';
+
+    command->kind = length > 0 ? findVerb(verb, length) : CMD_UNKNOWN;
+    command->argument = *argument ? argument : NULL;
+    if (command->argument && !(kinds[command->kind].flags & COMMAND_ARGUMENT))
+        command->kind = CMD_UNKNOWN;
+    command->flags = kinds[command->kind].flags;
+}
+
+int commandChangesGame(const ParsedCommand *command)
+{
+    return !(command->flags & COMMAND_READ_ONLY) &&
+           (command->argument || !(command->flags & COMMAND_ARGUMENT));
+}
@@ -0,0 +1,62 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+// Commands typed by the player. A line is tokenized once into a verb and
+// the rest of the line, its argument. Verbs and their aliases are found in
+// a hash table built on first use, so finding one costs a hash and a
+// compare however many verbs there are. Verbs are case-insensitive;
+// arguments, file paths in particular, are kept as typed.
+//
+// The parsed command is what the game, the journal and the server pass
+// around, so no path looks at the text of a command twice.
+
+enum CommandKind
+{
+    CMD_MOVE,
+    CMD_GOTO,
+    CMD_LOOK,
+    CMD_MAP,
+    CMD_INVENTORY,
+    CMD_PICKUP,
+    CMD_ATTACK,
+    CMD_SAVE,
+    CMD_BGSAVE,
+    CMD_LOAD,
+    CMD_EXPORT,
+    CMD_FIGHTS,
+    CMD_HELP,
+    CMD_STATS,
+    CMD_QUIT,
+    CMD_UNKNOWN,
+    CMD_KIND_COUNT
+};
+
+enum CommandFlags
+{
+    COMMAND_ARGUMENT = 1, // Takes an argument
+    COMMAND_READ_ONLY = 2 // Leaves the game as it is, so it is not journaled
+};
+
+typedef struct ParsedCommand
+{
+    int kind;       // CommandKind, CMD_UNKNOWN if the line is no command
+    int flags;      // CommandFlags of the kind
+    char *argument; // Inside the parsed line, NULL if there is none
+} ParsedCommand;
+
+// Name of a command kind, as typed by the player
+const char *commandKindName(int kind);
+
+// What the argument of a command kind is, for usage messages
+const char *commandArgumentName(int kind);
+
+// Tokenize a line in place: the verb is looked up and the argument, with
+// surrounding blanks removed, is terminated inside the line. A command that
+// takes an argument but was typed without one is parsed with a NULL
+// argument; one that takes none but was given one is CMD_UNKNOWN.
+void parseCommand(char *line, ParsedCommand *command);
+
+// Whether running the command can change the game
+int commandChangesGame(const ParsedCommand *command);
+
+#endif // COMMAND_H
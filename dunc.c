@@ -0,0 +1,590 @@
+// dunc - compile a text dungeon definition into a binary dungeon file
+//
+// Usage: dunc [-c name] <input.txt> <output>
+//
+// With -c the output is C source instead: the same file image as a static
+// read-only array called name (see dungeonWriteSource), which a program
+// compiles in to start without reading a dungeon file.
+//
+// The text format is line based. Blank lines and lines starting with '#'
+// are ignored, everything after a keyword is its value:
+//
+//   start <room>                 room the player starts in (default 0)
+//   goal <room>                  room of the creature that must be defeated
+//   room <index>                 begin a room, the following lines apply to it
+//     description <text>
+//     up|down|left|right <room>  connection to another room
+//     item <name>                item lying in the room
+//     creature <name> <health>   creature guarding the room
+//     gate <direction> item <name>
+//     gate <direction> kill <room>
+//                                lock an exit until the player carries the
+//                                item or has killed the creature of the room
+//       locked <text>            message when the last gate stays shut
+//       bonus <strength>         strength gained passing the last gate
+//     variant item <name>
+//     variant kill <room>        begin a description variant of the room
+//       and item <name>
+//       and kill <room>          further requirement of the last variant
+//       text <text>              description once all are met
+//
+// Requirements of gates and variants are compiled to capability bits, so
+// the game checks each with a single mask test. When several variants of
+// a room apply, the last one wins.
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "dungeon.h"
+
+#define MAX_LINE 4096
+
+typedef struct SourceRoom
+{
+    int declared;
+    uint32_t description;
+    int32_t exits[DIR_COUNT];
+    int exitLines[DIR_COUNT]; // Line numbers, for error messages
+    uint32_t firstSlot;
+    uint32_t itemCount;
+    uint32_t creature;
+    int32_t creatureHealth;
+    uint32_t firstGate;
+    uint32_t gateCount;
+    uint32_t firstVariant;
+    uint32_t variantCount;
+} SourceRoom;
+
+typedef struct Compiler
+{
+    SourceRoom *rooms;
+    int roomCount;
+    int roomCapacity;
+
+    uint16_t *slots;
+    uint32_t slotCount;
+    uint32_t slotCapacity;
+
+    uint32_t *itemNames;
+    int itemCount;
+    int itemCapacity;
+
+    DungeonGate *gates;
+    uint32_t gateCount;
+    uint32_t gateCapacity;
+
+    DungeonVariant *variants;
+    int *variantLines; // Line of each variant, for error messages
+    uint32_t variantCount;
+    uint32_t variantCapacity;
+
+    DungeonRequirement requirements[DUNGEON_MAX_REQUIREMENTS];
+    int requirementLines[DUNGEON_MAX_REQUIREMENTS]; // First use of each
+    uint32_t requirementCount;
+
+    // Interned strings, deduplicated through an open addressing table
+    char *strings;
+    uint32_t stringBytes;
+    uint32_t stringCapacity;
+    uint32_t *stringTable;
+    uint32_t stringTableSize;
+    uint32_t stringTableUsed;
+
+    const char *path;
+    int line;
+} Compiler;
+
+static void fail(const Compiler *c, const char *message)
+{
+    fprintf(stderr, "%s:%d: %s\n", c->path, c->line, message);
+    exit(1);
+}
+
+static void freeCompiler(Compiler *c)
+{
+    free(c->rooms);
+    free(c->slots);
+    free(c->itemNames);
+    free(c->gates);
+    free(c->variants);
+    free(c->variantLines);
+    free(c->strings);
+    free(c->stringTable);
+    memset(c, 0, sizeof(*c));
+}
+
+static void *grow(void *array, size_t elementSize, size_t *capacity, size_t needed)
+{
+    if (needed <= *capacity)
+        return array;
+    size_t newCapacity = *capacity ? *capacity : 16;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+    array = realloc(array, newCapacity * elementSize);
+    if (!array)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    *capacity = newCapacity;
+    return array;
+}
+
+static uint32_t hashString(const char *s)
+{
+    uint32_t hash = 2166136261u;
+    while (*s)
+    {
+        hash ^= (unsigned char)*s++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void rehashStrings(Compiler *c, uint32_t newSize)
+{
+    uint32_t *table = malloc(sizeof(uint32_t) * newSize);
+    if (!table)
+        fail(c, "out of memory");
+    memset(table, 0xff, sizeof(uint32_t) * newSize);
+    for (uint32_t i = 0; i < c->stringTableSize; i++)
+    {
+        uint32_t offset = c->stringTable[i];
+        if (offset == UINT32_MAX)
+            continue;
+        uint32_t slot = hashString(c->strings + offset) & (newSize - 1);
+        while (table[slot] != UINT32_MAX)
+            slot = (slot + 1) & (newSize - 1);
+        table[slot] = offset;
+    }
+    free(c->stringTable);
+    c->stringTable = table;
+    c->stringTableSize = newSize;
+}
+
+// Return the string table offset of s, adding it if it is new
+static uint32_t intern(Compiler *c, const char *s)
+{
+    if (*s == '\0')
+        return 0;
+    if ((c->stringTableUsed + 1) * 2 > c->stringTableSize)
+        rehashStrings(c, c->stringTableSize ? c->stringTableSize * 2 : 1024);
+
+    uint32_t slot = hashString(s) & (c->stringTableSize - 1);
+    while (c->stringTable[slot] != UINT32_MAX)
+    {
+        if (strcmp(c->strings + c->stringTable[slot], s) == 0)
+            return c->stringTable[slot];
+        slot = (slot + 1) & (c->stringTableSize - 1);
+    }
+
+    size_t length = strlen(s) + 1;
+    size_t capacity = c->stringCapacity;
+    c->strings = grow(c->strings, 1, &capacity, (size_t)c->stringBytes + length);
+    c->stringCapacity = (uint32_t)capacity;
+    uint32_t offset = c->stringBytes;
+    memcpy(c->strings + offset, s, length);
+    c->stringBytes += (uint32_t)length;
+    c->stringTable[slot] = offset;
+    c->stringTableUsed++;
+    return offset;
+}
+
+static int parseIndex(const Compiler *c, const char *value)
+{
+    char *end;
+    long index = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || index < 0 || index > INT32_MAX - 1)
+        fail(c, "expected a room index");
+    return (int)index;
+}
+
+static SourceRoom *declareRoom(Compiler *c, int index)
+{
+    if (index >= c->roomCount)
+    {
+        size_t capacity = (size_t)c->roomCapacity;
+        c->rooms = grow(c->rooms, sizeof(SourceRoom), &capacity, (size_t)index + 1);
+        c->roomCapacity = (int)capacity;
+        for (int i = c->roomCount; i <= index; i++)
+        {
+            memset(&c->rooms[i], 0, sizeof(SourceRoom));
+            for (int d = 0; d < DIR_COUNT; d++)
+                c->rooms[i].exits[d] = DUNGEON_NO_ROOM;
+        }
+        c->roomCount = index + 1;
+    }
+    SourceRoom *room = &c->rooms[index];
+    if (room->declared)
+        fail(c, "room declared twice");
+    room->declared = 1;
+    room->firstSlot = c->slotCount;
+    room->firstGate = c->gateCount;
+    room->firstVariant = c->variantCount;
+    return room;
+}
+
+static int findItem(const Compiler *c, uint32_t name)
+{
+    for (int i = 0; i < c->itemCount; i++)
+    {
+        if (c->itemNames[i] == name)
+            return i;
+    }
+    return -1;
+}
+
+// Item index of a name, adding the item if it is new
+static int itemIndex(Compiler *c, const char *name)
+{
+    uint32_t offset = intern(c, name);
+    int item = findItem(c, offset);
+    if (item < 0)
+    {
+        if (c->itemCount > UINT16_MAX)
+            fail(c, "too many distinct items");
+        size_t capacity = (size_t)c->itemCapacity;
+        c->itemNames = grow(c->itemNames, sizeof(uint32_t), &capacity, (size_t)c->itemCount + 1);
+        c->itemCapacity = (int)capacity;
+        item = c->itemCount++;
+        c->itemNames[item] = offset;
+    }
+    return item;
+}
+
+static void addItem(Compiler *c, SourceRoom *room, const char *name)
+{
+    if (room->itemCount >= DUNGEON_MAX_ROOM_ITEMS)
+        fail(c, "too many items in room");
+
+    int item = itemIndex(c, name);
+
+    size_t capacity = c->slotCapacity;
+    c->slots = grow(c->slots, sizeof(uint16_t), &capacity, (size_t)c->slotCount + 1);
+    c->slotCapacity = (uint32_t)capacity;
+    c->slots[c->slotCount++] = (uint16_t)item;
+    room->itemCount++;
+}
+
+static void addCreature(Compiler *c, SourceRoom *room, char *value)
+{
+    // The health is the last word, the name is everything before it
+    char *health = strrchr(value, ' ');
+    if (!health)
+        fail(c, "expected: creature <name> <health>");
+    *health++ = '\0';
+    char *end;
+    long hp = strtol(health, &end, 10);
+    if (end == health || *end != '\0' || hp <= 0 || hp > INT32_MAX)
+        fail(c, "creature health must be a positive number");
+    room->creature = intern(c, value);
+    room->creatureHealth = (int32_t)hp;
+}
+
+// Capability bit of a requirement, shared by every gate and variant that
+// needs the same
+static uint32_t requirementIndex(Compiler *c, uint32_t kind, uint32_t value)
+{
+    for (uint32_t i = 0; i < c->requirementCount; i++)
+    {
+        if (c->requirements[i].kind == kind && c->requirements[i].value == value)
+            return i;
+    }
+    if (c->requirementCount == DUNGEON_MAX_REQUIREMENTS)
+        fail(c, "too many distinct requirements");
+    c->requirements[c->requirementCount].kind = kind;
+    c->requirements[c->requirementCount].value = value;
+    c->requirementLines[c->requirementCount] = c->line;
+    return c->requirementCount++;
+}
+
+// Parse "item <name>" or "kill <room>" into its capability bit. Returns 0 on
+// success, -1 if value is neither.
+static int parseRequirement(Compiler *c, char *value, uint32_t *requirement)
+{
+    char *argument = value + strcspn(value, " \t");
+    if (*argument)
+        *argument++ = '\0';
+    while (isspace((unsigned char)*argument))
+        argument++;
+    if (*argument == '\0')
+        return -1;
+    if (strcmp(value, "item") == 0)
+        *requirement = requirementIndex(c, REQUIRE_ITEM, (uint32_t)itemIndex(c, argument));
+    else if (strcmp(value, "kill") == 0)
+        *requirement = requirementIndex(c, REQUIRE_KILL, (uint32_t)parseIndex(c, argument));
+    else
+        return -1;
+    return 0;
+}
+
+static void addGate(Compiler *c, SourceRoom *room, char *value)
+{
+    char *kind = value + strcspn(value, " \t");
+    if (*kind)
+        *kind++ = '\0';
+    int direction = directionFromName(value);
+    uint32_t requirement = 0;
+    if (direction < 0 || parseRequirement(c, kind, &requirement) != 0)
+        fail(c, "expected: gate <direction> item <name> | gate <direction> kill <room>");
+
+    for (uint32_t i = 0; i < room->gateCount; i++)
+    {
+        if (c->gates[room->firstGate + i].direction == (uint32_t)direction)
+            fail(c, "exit already has a gate");
+    }
+
+    size_t capacity = c->gateCapacity;
+    c->gates = grow(c->gates, sizeof(DungeonGate), &capacity, (size_t)c->gateCount + 1);
+    c->gateCapacity = (uint32_t)capacity;
+
+    DungeonGate *gate = &c->gates[c->gateCount];
+    memset(gate, 0, sizeof(*gate));
+    gate->direction = (uint32_t)direction;
+    gate->requirement = requirement;
+    c->gateCount++;
+    room->gateCount++;
+}
+
+// The gate the last 'locked' or 'bonus' line applies to
+static DungeonGate *lastGate(const Compiler *c, const SourceRoom *room)
+{
+    if (room->gateCount == 0)
+        fail(c, "expected 'gate' before gate properties");
+    return &c->gates[room->firstGate + room->gateCount - 1];
+}
+
+static void addVariant(Compiler *c, SourceRoom *room, char *value)
+{
+    uint32_t requirement = 0;
+    if (parseRequirement(c, value, &requirement) != 0)
+        fail(c, "expected: variant item <name> | variant kill <room>");
+
+    size_t capacity = c->variantCapacity;
+    c->variants = grow(c->variants, sizeof(DungeonVariant), &capacity, (size_t)c->variantCount + 1);
+    capacity = c->variantCapacity;
+    c->variantLines = grow(c->variantLines, sizeof(int), &capacity, (size_t)c->variantCount + 1);
+    c->variantCapacity = (uint32_t)capacity;
+
+    DungeonVariant *variant = &c->variants[c->variantCount];
+    memset(variant, 0, sizeof(*variant));
+    variant->requires = 1ull << requirement;
+    c->variantLines[c->variantCount++] = c->line;
+    room->variantCount++;
+}
+
+// The variant the last 'and' or 'text' line applies to
+static DungeonVariant *lastVariant(const Compiler *c, const SourceRoom *room)
+{
+    if (room->variantCount == 0)
+        fail(c, "expected 'variant' before variant properties");
+    return &c->variants[room->firstVariant + room->variantCount - 1];
+}
+
+static char *trim(char *s)
+{
+    while (isspace((unsigned char)*s))
+        s++;
+    size_t length = strlen(s);
+    while (length > 0 && isspace((unsigned char)s[length - 1]))
+        s[--length] = '\0';
+    return s;
+}
+
+int main(int argc, char **argv)
+{
+    const char *sourceName = NULL;
+    if (argc == 5 && strcmp(argv[1], "-c") == 0)
+    {
+        sourceName = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s [-c name] <input.txt> <output>\n", argv[0]);
+        return 1;
+    }
+
+    Compiler c;
+    memset(&c, 0, sizeof(c));
+    c.path = argv[1];
+    // Offset 0 is the empty string, used for "no description" and "no creature"
+    size_t stringCapacity = 0;
+    c.strings = grow(NULL, 1, &stringCapacity, 1);
+    c.stringCapacity = (uint32_t)stringCapacity;
+    c.strings[0] = '\0';
+    c.stringBytes = 1;
+
+    FILE *input = fopen(argv[1], "r");
+    if (!input)
+    {
+        fprintf(stderr, "Error opening %s.\n", argv[1]);
+        return 1;
+    }
+
+    int startRoom = 0;
+    int goalRoom = DUNGEON_NO_ROOM;
+    int startLine = 0, goalLine = 0;
+    SourceRoom *room = NULL;
+    char buffer[MAX_LINE];
+    while (fgets(buffer, sizeof(buffer), input))
+    {
+        c.line++;
+        if (!strchr(buffer, '\n') && !feof(input))
+            fail(&c, "line too long");
+
+        char *line = trim(buffer);
+        if (*line == '\0' || *line == '#')
+            continue;
+
+        char *value = line + strcspn(line, " \t");
+        if (*value)
+            *value++ = '\0';
+        value = trim(value);
+
+        int direction = directionFromName(line);
+        if (strcmp(line, "start") == 0)
+        {
+            startRoom = parseIndex(&c, value);
+            startLine = c.line;
+        }
+        else if (strcmp(line, "goal") == 0)
+        {
+            goalRoom = parseIndex(&c, value);
+            goalLine = c.line;
+        }
+        else if (strcmp(line, "room") == 0)
+            room = declareRoom(&c, parseIndex(&c, value));
+        else if (!room)
+            fail(&c, "expected 'room' before room properties");
+        else if (strcmp(line, "description") == 0)
+            room->description = intern(&c, value);
+        else if (direction >= 0)
+        {
+            room->exits[direction] = parseIndex(&c, value);
+            room->exitLines[direction] = c.line;
+        }
+        else if (strcmp(line, "item") == 0)
+        {
+            if (*value == '\0')
+                fail(&c, "expected an item name");
+            addItem(&c, room, value);
+        }
+        else if (strcmp(line, "creature") == 0)
+            addCreature(&c, room, value);
+        else if (strcmp(line, "gate") == 0)
+            addGate(&c, room, value);
+        else if (strcmp(line, "locked") == 0)
+            lastGate(&c, room)->message = intern(&c, value);
+        else if (strcmp(line, "bonus") == 0)
+        {
+            char *end;
+            long bonus = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || bonus < INT32_MIN || bonus > INT32_MAX)
+                fail(&c, "expected a strength bonus");
+            lastGate(&c, room)->strengthBonus = (int32_t)bonus;
+        }
+        else if (strcmp(line, "variant") == 0)
+            addVariant(&c, room, value);
+        else if (strcmp(line, "and") == 0)
+        {
+            DungeonVariant *variant = lastVariant(&c, room);
+            uint32_t requirement = 0;
+            if (parseRequirement(&c, value, &requirement) != 0)
+                fail(&c, "expected: and item <name> | and kill <room>");
+            variant->requires |= 1ull << requirement;
+        }
+        else if (strcmp(line, "text") == 0)
+            lastVariant(&c, room)->description = intern(&c, value);
+        else
+            fail(&c, "unknown keyword");
+    }
+    fclose(input);
+
+    // Items, gates and variants of a room must be contiguous in their tables, which
+    // holds as long as every room is declared exactly once.
+    if (c.roomCount == 0)
+    {
+        c.line = 0;
+        fail(&c, "no rooms defined");
+    }
+    for (int i = 0; i < c.roomCount; i++)
+    {
+        for (int d = 0; d < DIR_COUNT; d++)
+        {
+            if (c.rooms[i].exits[d] >= c.roomCount)
+            {
+                c.line = c.rooms[i].exitLines[d];
+                fail(&c, "connection to a room that does not exist");
+            }
+        }
+    }
+    for (uint32_t i = 0; i < c.requirementCount; i++)
+    {
+        const DungeonRequirement *requirement = &c.requirements[i];
+        c.line = c.requirementLines[i];
+        if (requirement->kind == REQUIRE_KILL &&
+            (requirement->value >= (uint32_t)c.roomCount || c.rooms[requirement->value].creature == 0))
+            fail(&c, "kill required in a room without a creature");
+    }
+    for (uint32_t i = 0; i < c.variantCount; i++)
+    {
+        c.line = c.variantLines[i];
+        if (c.variants[i].description == 0)
+            fail(&c, "variant without a 'text' line");
+    }
+    c.line = startLine;
+    if (startRoom >= c.roomCount)
+        fail(&c, "start room does not exist");
+    c.line = goalLine;
+    if (goalRoom >= c.roomCount)
+        fail(&c, "goal room does not exist");
+
+    // The rooms are packed into the file layout only now that every
+    // forward reference has been checked.
+    DungeonRoom *records = calloc((size_t)c.roomCount + 1, sizeof(DungeonRoom));
+    if (!records)
+        fail(&c, "out of memory");
+    for (int i = 0; i < c.roomCount; i++)
+    {
+        records[i].description = c.rooms[i].description;
+        memcpy(records[i].exits, c.rooms[i].exits, sizeof(records[i].exits));
+        records[i].firstSlot = c.rooms[i].firstSlot;
+        records[i].itemCount = c.rooms[i].itemCount;
+        records[i].creature = c.rooms[i].creature;
+        records[i].creatureHealth = c.rooms[i].creatureHealth;
+        records[i].firstGate = c.rooms[i].firstGate;
+        records[i].gateCount = c.rooms[i].gateCount;
+        records[i].firstVariant = c.rooms[i].firstVariant;
+        records[i].variantCount = c.rooms[i].variantCount;
+    }
+
+    DungeonImage image = {
+        .startRoom = startRoom,
+        .goalRoom = goalRoom,
+        .rooms = records,
+        .roomCount = (uint32_t)c.roomCount,
+        .itemNames = c.itemNames,
+        .itemCount = (uint32_t)c.itemCount,
+        .slots = c.slots,
+        .slotCount = c.slotCount,
+        .gates = c.gates,
+        .gateCount = c.gateCount,
+        .requirements = c.requirements,
+        .requirementCount = c.requirementCount,
+        .variants = c.variants,
+        .variantCount = c.variantCount,
+        .strings = c.strings,
+        .stringBytes = c.stringBytes,
+    };
+    int failed = sourceName ? dungeonWriteSource(argv[2], sourceName, &image) != 0
+                            : dungeonWrite(argv[2], &image) != 0;
+    free(records);
+    if (!failed)
+        printf("%s: %d rooms, %d items, %u gates, %u variants, %u string bytes\n",
+               argv[2], c.roomCount, c.itemCount, c.gateCount, c.variantCount, c.stringBytes);
+    freeCompiler(&c);
+    return failed;
+}
@@ -0,0 +1,420 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // For strcasecmp()
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dungeon.h"
+#include "roomcache.h"
+#include "stats.h"
+
+static const char *directionNames[DIR_COUNT] = {"up", "down", "left", "right"};
+
+// Check that a section of count elements of the given size lies inside the file
+static int sectionFits(uint64_t offset, uint64_t count, uint64_t size, size_t fileSize)
+{
+    if (offset % 8 != 0 || offset > fileSize)
+        return 0;
+    return count <= (fileSize - offset) / size;
+}
+
+// The dungeon baked into the program, if any
+static const void *builtinImage;
+static size_t builtinSize;
+
+// Check the header of a dungeon image and point the dungeon's sections
+// into it. Only the header is validated so that opening stays O(1); room
+// links and string offsets are range checked where they are used.
+static int attachImage(Dungeon *dungeon, const void *image, size_t size, const char *path)
+{
+    const DungeonHeader *header = image;
+    const char *base = image;
+    if (size < sizeof(DungeonHeader) ||
+        header->magic != DUNGEON_MAGIC || header->version != DUNGEON_VERSION ||
+        !sectionFits(header->roomsOffset, header->roomCount, sizeof(DungeonRoom), size) ||
+        !sectionFits(header->itemsOffset, header->itemCount, sizeof(uint32_t), size) ||
+        !sectionFits(header->slotsOffset, header->slotCount, sizeof(uint16_t), size) ||
+        !sectionFits(header->gatesOffset, header->gateCount, sizeof(DungeonGate), size) ||
+        !sectionFits(header->requirementsOffset, header->requirementCount, sizeof(DungeonRequirement), size) ||
+        header->requirementCount > DUNGEON_MAX_REQUIREMENTS ||
+        !sectionFits(header->variantsOffset, header->variantCount, sizeof(DungeonVariant), size) ||
+        !sectionFits(header->stringsOffset, header->stringBytes, 1, size) ||
+        header->roomCount == 0 || header->roomCount > INT32_MAX ||
+        header->stringBytes == 0 || base[header->stringsOffset + header->stringBytes - 1] != '\0' ||
+        header->startRoom < 0 || (uint32_t)header->startRoom >= header->roomCount)
+    {
+        fprintf(stderr, "%s is not a valid dungeon file.\n", path);
+        return -1;
+    }
+
+    dungeon->header = header;
+    dungeon->rooms = (const DungeonRoom *)(base + header->roomsOffset);
+    dungeon->itemNames = (const uint32_t *)(base + header->itemsOffset);
+    dungeon->slots = (const uint16_t *)(base + header->slotsOffset);
+    dungeon->gates = (const DungeonGate *)(base + header->gatesOffset);
+    dungeon->requirements = (const DungeonRequirement *)(base + header->requirementsOffset);
+    dungeon->variants = (const DungeonVariant *)(base + header->variantsOffset);
+    dungeon->strings = base + header->stringsOffset;
+    dungeon->roomCount = (int)header->roomCount;
+    dungeon->itemCount = (int)header->itemCount;
+    dungeon->requirementCount = (int)header->requirementCount;
+    return 0;
+}
+
+// Items are few, so all of them are interned up front and the game only
+// ever handles item ids. On failure the dungeon is closed.
+static int internItems(Dungeon *dungeon, const char *path)
+{
+    ItemId *itemIds = statsMalloc(sizeof(ItemId) * ((size_t)dungeon->itemCount + 1));
+    for (int i = 0; itemIds && i < dungeon->itemCount; i++)
+    {
+        itemIds[i] = itemIntern(dungeonItemName(dungeon, i));
+        if (itemIds[i] == ITEM_NONE)
+        {
+            free(itemIds);
+            itemIds = NULL;
+        }
+    }
+    if (!itemIds)
+    {
+        fprintf(stderr, "Out of memory loading %s.\n", path);
+        dungeonClose(dungeon);
+        return -1;
+    }
+    dungeon->itemIds = itemIds;
+    return 0;
+}
+
+// Open a dungeon file, paging its rooms through a cache of cacheChunks
+// chunks, or reading them from the mapping if cacheChunks is 0
+static int openDungeon(Dungeon *dungeon, const char *path, int cacheChunks)
+{
+    if (strcmp(path, BUILTIN_DUNGEON) == 0)
+    {
+        if (builtinImage)
+            return dungeonOpenMemory(dungeon, builtinImage, builtinSize);
+        fprintf(stderr, "This program has no built-in dungeon.\n");
+        return -1;
+    }
+
+    memset(dungeon, 0, sizeof(*dungeon));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error opening dungeon file %s.\n", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DungeonHeader))
+    {
+        fprintf(stderr, "Dungeon file %s is too small.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    // The file is never written, so a private read-only mapping lets every
+    // process share the page cache and only touched pages become resident.
+    size_t size = (size_t)st.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Error mapping dungeon file %s.\n", path);
+        close(fd);
+        return -1;
+    }
+    if (cacheChunks == 0)
+        close(fd);
+
+    if (attachImage(dungeon, mapping, size, path) != 0)
+    {
+        munmap(mapping, size);
+        if (cacheChunks != 0)
+            close(fd);
+        return -1;
+    }
+    madvise(mapping, size, MADV_RANDOM);
+    dungeon->mapping = mapping;
+    dungeon->mappingSize = size;
+
+    // A paged dungeon never touches the room section of the mapping, so
+    // none of it becomes resident; the cache reads rooms with pread.
+    if (cacheChunks != 0)
+    {
+        RoomCache *cache = statsMalloc(sizeof(RoomCache));
+        if (!cache || roomCacheInit(cache, fd, dungeon->header->roomsOffset, dungeon->header->roomCount, cacheChunks) != 0)
+        {
+            fprintf(stderr, "Out of memory loading %s.\n", path);
+            free(cache);
+            close(fd);
+            dungeonClose(dungeon);
+            return -1;
+        }
+        dungeon->rooms = NULL;
+        dungeon->cache = cache;
+    }
+    return internItems(dungeon, path);
+}
+
+int dungeonOpen(Dungeon *dungeon, const char *path)
+{
+    return openDungeon(dungeon, path, 0);
+}
+
+int dungeonOpenPaged(Dungeon *dungeon, const char *path, int cacheChunks)
+{
+    return openDungeon(dungeon, path, cacheChunks > 0 ? cacheChunks : ROOM_CACHE_DEFAULT_CHUNKS);
+}
+
+int dungeonOpenMemory(Dungeon *dungeon, const void *image, size_t size)
+{
+    memset(dungeon, 0, sizeof(*dungeon));
+    if (attachImage(dungeon, image, size, BUILTIN_DUNGEON) != 0)
+        return -1;
+    return internItems(dungeon, BUILTIN_DUNGEON);
+}
+
+void dungeonSetBuiltin(const void *image, size_t size)
+{
+    builtinImage = image;
+    builtinSize = size;
+}
+
+const char *dungeonDefaultPath(void)
+{
+    return builtinImage ? BUILTIN_DUNGEON : DEFAULT_DUNGEON;
+}
+
+static size_t align8(size_t offset)
+{
+    return (offset + 7) & ~(size_t)7;
+}
+
+static void writeSection(FILE *file, const void *data, size_t size, size_t offset)
+{
+    static const char zeros[8];
+    long position = ftell(file);
+    if (position < 0 || (size_t)position > offset)
+        return;
+    fwrite(zeros, 1, offset - (size_t)position, file);
+    if (size > 0)
+        fwrite(data, 1, size, file);
+}
+
+// Write a dungeon file image to a stream positioned at its start
+static void writeImage(FILE *output, const DungeonImage *image)
+{
+    DungeonHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DUNGEON_MAGIC;
+    header.version = DUNGEON_VERSION;
+    header.roomCount = image->roomCount;
+    header.itemCount = image->itemCount;
+    header.slotCount = image->slotCount;
+    header.stringBytes = image->stringBytes;
+    header.startRoom = image->startRoom;
+    header.goalRoom = image->goalRoom;
+    header.gateCount = image->gateCount;
+    header.requirementCount = image->requirementCount;
+    header.variantCount = image->variantCount;
+    header.roomsOffset = align8(sizeof(header));
+    header.itemsOffset = align8(header.roomsOffset + sizeof(DungeonRoom) * (size_t)image->roomCount);
+    header.slotsOffset = align8(header.itemsOffset + sizeof(uint32_t) * (size_t)image->itemCount);
+    header.gatesOffset = align8(header.slotsOffset + sizeof(uint16_t) * (size_t)image->slotCount);
+    header.requirementsOffset = align8(header.gatesOffset + sizeof(DungeonGate) * (size_t)image->gateCount);
+    header.variantsOffset = align8(header.requirementsOffset + sizeof(DungeonRequirement) * (size_t)image->requirementCount);
+    header.stringsOffset = align8(header.variantsOffset + sizeof(DungeonVariant) * (size_t)image->variantCount);
+
+    fwrite(&header, sizeof(header), 1, output);
+    writeSection(output, image->rooms, sizeof(DungeonRoom) * (size_t)image->roomCount, header.roomsOffset);
+    writeSection(output, image->itemNames, sizeof(uint32_t) * (size_t)image->itemCount, header.itemsOffset);
+    writeSection(output, image->slots, sizeof(uint16_t) * (size_t)image->slotCount, header.slotsOffset);
+    writeSection(output, image->gates, sizeof(DungeonGate) * (size_t)image->gateCount, header.gatesOffset);
+    writeSection(output, image->requirements, sizeof(DungeonRequirement) * (size_t)image->requirementCount, header.requirementsOffset);
+    writeSection(output, image->variants, sizeof(DungeonVariant) * (size_t)image->variantCount, header.variantsOffset);
+    writeSection(output, image->strings, image->stringBytes, header.stringsOffset);
+}
+
+int dungeonWrite(const char *path, const DungeonImage *image)
+{
+    FILE *output = fopen(path, "wb");
+    if (!output)
+    {
+        fprintf(stderr, "Error opening %s for writing.\n", path);
+        return -1;
+    }
+    setvbuf(output, NULL, _IOFBF, 1 << 20);
+    writeImage(output, image);
+    if (ferror(output) | fclose(output))
+    {
+        fprintf(stderr, "Error writing %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int dungeonWriteSource(const char *path, const char *name, const DungeonImage *image)
+{
+    char *bytes = NULL;
+    size_t size = 0;
+    FILE *memory = open_memstream(&bytes, &size);
+    if (!memory)
+    {
+        fprintf(stderr, "Out of memory writing %s.\n", path);
+        return -1;
+    }
+    writeImage(memory, image);
+    // Pad to whole words, the image is emitted as uint64_t for alignment
+    static const char zeros[8];
+    fwrite(zeros, 1, (8 - ftell(memory) % 8) % 8, memory);
+    if (ferror(memory) | fclose(memory))
+    {
+        fprintf(stderr, "Out of memory writing %s.\n", path);
+        free(bytes);
+        return -1;
+    }
+
+    FILE *output = fopen(path, "w");
+    if (!output)
+    {
+        fprintf(stderr, "Error opening %s for writing.\n", path);
+        free(bytes);
+        return -1;
+    }
+    setvbuf(output, NULL, _IOFBF, 1 << 20);
+    fprintf(output, "// Generated by dunc, do not edit. A dungeon file image in host byte\n"
+                    "// order, see dungeon.h.\n"
+                    "#include <stddef.h>\n"
+                    "#include <stdint.h>\n\n"
+                    "const uint64_t %s[] = {", name);
+    for (size_t i = 0; i < size / 8; i++)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + 8 * i, sizeof(word));
+        fprintf(output, "%s0x%016llx,", i % 4 == 0 ? "\n    " : " ", (unsigned long long)word);
+    }
+    fprintf(output, "\n};\n\nconst size_t %sSize = %zu;\n", name, size);
+    free(bytes);
+    if (ferror(output) | fclose(output))
+    {
+        fprintf(stderr, "Error writing %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+void dungeonClose(Dungeon *dungeon)
+{
+    if (dungeon->mapping)
+        munmap(dungeon->mapping, dungeon->mappingSize);
+    if (dungeon->cache)
+    {
+        roomCacheFree(dungeon->cache);
+        free(dungeon->cache);
+    }
+    free(dungeon->itemIds);
+    memset(dungeon, 0, sizeof(*dungeon));
+}
+
+const DungeonRoom *dungeonRoom(const Dungeon *dungeon, int room)
+{
+    if (dungeon->cache)
+        return roomCacheGet(dungeon->cache, room);
+    return &dungeon->rooms[room];
+}
+
+const char *dungeonString(const Dungeon *dungeon, uint32_t offset)
+{
+    if (offset >= dungeon->header->stringBytes)
+        return "";
+    return dungeon->strings + offset;
+}
+
+const char *dungeonItemName(const Dungeon *dungeon, int item)
+{
+    if (item < 0 || item >= dungeon->itemCount)
+        return "";
+    return dungeonString(dungeon, dungeon->itemNames[item]);
+}
+
+int dungeonRoomItemCount(const DungeonRoom *room)
+{
+    return room->itemCount <= DUNGEON_MAX_ROOM_ITEMS ? (int)room->itemCount : 0;
+}
+
+int dungeonRoomItem(const Dungeon *dungeon, const DungeonRoom *room, int slot)
+{
+    uint32_t index = room->firstSlot + (uint32_t)slot;
+    if (index >= dungeon->header->slotCount)
+        return -1;
+    return dungeon->slots[index];
+}
+
+ItemId dungeonRoomItemId(const Dungeon *dungeon, const DungeonRoom *room, int slot)
+{
+    int item = dungeonRoomItem(dungeon, room, slot);
+    if (item < 0 || item >= dungeon->itemCount)
+        return ITEM_NONE;
+    return dungeon->itemIds[item];
+}
+
+const DungeonGate *dungeonExitGate(const Dungeon *dungeon, int room, int direction)
+{
+    const DungeonRoom *r = dungeonRoom(dungeon, room);
+    if (r->firstGate > dungeon->header->gateCount || r->gateCount > dungeon->header->gateCount - r->firstGate)
+        return NULL;
+    for (uint32_t i = 0; i < r->gateCount; i++)
+    {
+        const DungeonGate *gate = &dungeon->gates[r->firstGate + i];
+        if (gate->direction == (uint32_t)direction)
+            return gate->requirement < (uint32_t)dungeon->requirementCount ? gate : NULL;
+    }
+    return NULL;
+}
+
+const char *dungeonDescription(const Dungeon *dungeon, const DungeonRoom *room, uint64_t capabilities)
+{
+    uint32_t description = room->description;
+    uint32_t variantCount = dungeon->header->variantCount;
+    if (room->firstVariant <= variantCount && room->variantCount <= variantCount - room->firstVariant)
+    {
+        const DungeonVariant *variants = &dungeon->variants[room->firstVariant];
+        for (uint32_t i = 0; i < room->variantCount; i++)
+        {
+            if ((variants[i].requires & ~capabilities) == 0)
+                description = variants[i].description;
+        }
+    }
+    return dungeonString(dungeon, description);
+}
+
+int dungeonFindItem(const Dungeon *dungeon, const char *name)
+{
+    for (int i = 0; i < dungeon->itemCount; i++)
+    {
+        if (strcasecmp(dungeonItemName(dungeon, i), name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int directionFromName(const char *name)
+{
+    for (int i = 0; i < DIR_COUNT; i++)
+    {
+        if (strcasecmp(name, directionNames[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+const char *directionName(int direction)
+{
+    if (direction < 0 || direction >= DIR_COUNT)
+        return "";
+    return directionNames[direction];
+}
@@ -0,0 +1,232 @@
+#ifndef DUNGEON_H
+#define DUNGEON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "items.h"
+
+// Binary dungeon file, produced by dunc from a text definition and mapped
+// read-only by the game. Every section is 8-byte aligned and read in place:
+//
+//   DungeonHeader
+//   DungeonRoom rooms[roomCount]
+//   uint32_t    itemNames[itemCount]  string offset of each distinct item
+//   uint16_t    slots[slotCount]      item index of every room item slot
+//   DungeonGate gates[gateCount]      locked exits, grouped by room
+//   DungeonRequirement requirements[requirementCount]
+//   DungeonVariant variants[variantCount]  description variants, by room
+//   char        strings[stringBytes]  NUL-terminated, offset 0 is ""
+//
+// A gate locks one exit of a room until the player meets a requirement:
+// carrying an item or having killed the creature of some room. Every
+// distinct requirement is one capability bit, so what the player can pass
+// is a single 64-bit mask.
+//
+// A description variant replaces the description of its room once the
+// player meets all of its requirements, given as a mask of the same bits.
+// Rules live entirely in the file: the game only ever tests masks.
+//
+// Integers are stored in host (little-endian) byte order.
+
+#define DEFAULT_DUNGEON "dungeon.dat" // Dungeon file used when none is given
+#define BUILTIN_DUNGEON "builtin"     // Names the dungeon baked into the program
+
+#define DUNGEON_MAGIC 0x4e47444eu // "NDGN"
+#define DUNGEON_VERSION 3
+#define DUNGEON_NO_ROOM -1
+#define DUNGEON_MAX_ROOM_ITEMS 64   // Room item state is a 64-bit mask
+#define DUNGEON_MAX_REQUIREMENTS 64 // Capabilities are a 64-bit mask
+
+enum Direction
+{
+    DIR_UP,
+    DIR_DOWN,
+    DIR_LEFT,
+    DIR_RIGHT,
+    DIR_COUNT
+};
+
+enum RequirementKind
+{
+    REQUIRE_ITEM, // Carry the item with index value
+    REQUIRE_KILL  // The creature of room value is dead
+};
+
+typedef struct DungeonHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t roomCount;
+    uint32_t itemCount;
+    uint32_t slotCount;
+    uint32_t stringBytes;
+    int32_t startRoom;
+    int32_t goalRoom; // Room of the creature that has to be defeated
+    uint32_t gateCount;
+    uint32_t requirementCount;
+    uint32_t variantCount;
+    uint32_t reserved;
+    uint64_t roomsOffset;
+    uint64_t itemsOffset;
+    uint64_t slotsOffset;
+    uint64_t gatesOffset;
+    uint64_t requirementsOffset;
+    uint64_t variantsOffset;
+    uint64_t stringsOffset;
+} DungeonHeader;
+
+typedef struct DungeonRoom
+{
+    uint32_t description;     // String offset
+    int32_t exits[DIR_COUNT]; // Room connections, DUNGEON_NO_ROOM if none
+    uint32_t firstSlot;       // First entry of the room in the slot table
+    uint32_t itemCount;       // Items in the room at the start of the game
+    uint32_t creature;        // String offset of the creature name, 0 if none
+    int32_t creatureHealth;   // Creature health at the start of the game
+    uint32_t firstGate;       // First gate of the room in the gate table
+    uint32_t gateCount;       // Locked exits of the room
+    uint32_t firstVariant;    // First variant of the room in the variant table
+    uint32_t variantCount;    // Description variants of the room
+} DungeonRoom;
+
+typedef struct DungeonGate
+{
+    uint32_t direction;     // Exit the gate locks
+    uint32_t requirement;   // Index of the requirement, also its capability bit
+    uint32_t message;       // String offset, shown when the gate stays shut
+    int32_t strengthBonus;  // Strength gained every time the gate is passed
+} DungeonGate;
+
+typedef struct DungeonRequirement
+{
+    uint32_t kind; // RequirementKind
+    uint32_t value;
+} DungeonRequirement;
+
+typedef struct DungeonVariant
+{
+    uint64_t requires;    // Capability bits that must all be set
+    uint32_t description; // String offset
+    uint32_t reserved;
+} DungeonVariant;
+
+typedef struct RoomCache RoomCache;
+
+// A loaded dungeon. The pointers refer into the file mapping, or into the
+// program for a built-in dungeon, except for itemIds, which maps the
+// dungeon's item indices to interned item ids.
+// A paged dungeon reads its rooms through a RoomCache instead, and rooms is
+// NULL; use dungeonRoom to reach the rooms of either kind.
+typedef struct Dungeon
+{
+    const DungeonHeader *header;
+    const DungeonRoom *rooms;
+    const uint32_t *itemNames;
+    const uint16_t *slots;
+    const DungeonGate *gates;
+    const DungeonRequirement *requirements;
+    const DungeonVariant *variants;
+    const char *strings;
+    ItemId *itemIds;
+    int roomCount;
+    int itemCount;
+    int requirementCount;
+    void *mapping;
+    size_t mappingSize;
+    RoomCache *cache; // Set for paged dungeons
+} Dungeon;
+
+// Contents of a dungeon file to be written, one array per section
+typedef struct DungeonImage
+{
+    int32_t startRoom;
+    int32_t goalRoom;
+    const DungeonRoom *rooms;
+    uint32_t roomCount;
+    const uint32_t *itemNames;
+    uint32_t itemCount;
+    const uint16_t *slots;
+    uint32_t slotCount;
+    const DungeonGate *gates;
+    uint32_t gateCount;
+    const DungeonRequirement *requirements;
+    uint32_t requirementCount;
+    const DungeonVariant *variants;
+    uint32_t variantCount;
+    const char *strings;
+    uint32_t stringBytes;
+} DungeonImage;
+
+// Write a dungeon file. Returns 0 on success, -1 on error.
+int dungeonWrite(const char *path, const DungeonImage *image);
+
+// Write the dungeon file image as C source defining
+//   const uint64_t name[];
+//   const size_t nameSize;
+// so it can be compiled into a program and opened with dungeonOpenMemory.
+// Returns 0 on success, -1 on error.
+int dungeonWriteSource(const char *path, const char *name, const DungeonImage *image);
+
+// Map a compiled dungeon file and intern its item names. Returns 0 on
+// success, -1 on error.
+int dungeonOpen(Dungeon *dungeon, const char *path);
+
+// Like dungeonOpen, but rooms are read from the file in chunks when first
+// used and at most cacheChunks chunks are kept (see roomcache.h), so the
+// memory rooms take is bounded whatever the size of the world.
+int dungeonOpenPaged(Dungeon *dungeon, const char *path, int cacheChunks);
+
+// Use a dungeon file image already in memory, such as one baked into the
+// program. Nothing is read or copied: the rooms and text are used where
+// they are, so a baked dungeon costs no I/O and its pages are shared by
+// every process running the program. The image must be 8-byte aligned and
+// outlive the dungeon.
+int dungeonOpenMemory(Dungeon *dungeon, const void *image, size_t size);
+
+// Make a dungeon image the program's built-in dungeon. Opening the path
+// BUILTIN_DUNGEON with dungeonOpen or dungeonOpenPaged then opens it with
+// dungeonOpenMemory.
+void dungeonSetBuiltin(const void *image, size_t size);
+
+// BUILTIN_DUNGEON if the program has a built-in dungeon, else DEFAULT_DUNGEON
+const char *dungeonDefaultPath(void);
+
+// Release a dungeon opened with any of the functions above
+void dungeonClose(Dungeon *dungeon);
+
+// Record of a room (0 <= room < roomCount). In a paged dungeon the pointer
+// is only good until rooms of other chunks are used, so do not keep it.
+const DungeonRoom *dungeonRoom(const Dungeon *dungeon, int room);
+
+// Resolve a string offset, out of range offsets resolve to ""
+const char *dungeonString(const Dungeon *dungeon, uint32_t offset);
+
+// Name of an item index
+const char *dungeonItemName(const Dungeon *dungeon, int item);
+
+// Items in a room at the start of the game. A room claiming more than
+// DUNGEON_MAX_ROOM_ITEMS, which only a damaged file can, is taken to have
+// none, since its item state would not fit the mask.
+int dungeonRoomItemCount(const DungeonRoom *room);
+
+// Item index of a room item slot (0 <= slot < dungeonRoomItemCount(room))
+int dungeonRoomItem(const Dungeon *dungeon, const DungeonRoom *room, int slot);
+
+// Item id of a room item slot, ITEM_NONE if the slot is out of range
+ItemId dungeonRoomItemId(const Dungeon *dungeon, const DungeonRoom *room, int slot);
+
+// Gate locking an exit of a room, NULL if the exit is open
+const DungeonGate *dungeonExitGate(const Dungeon *dungeon, int room, int direction);
+
+// Description of a room for a player with the given capabilities: the
+// last of its variants whose requirements are all met, or its own
+const char *dungeonDescription(const Dungeon *dungeon, const DungeonRoom *room, uint64_t capabilities);
+
+// Find an item by name (case-insensitive), -1 if the dungeon has no such item
+int dungeonFindItem(const Dungeon *dungeon, const char *name);
+
+// Direction names used by move and the text format
+int directionFromName(const char *name);
+const char *directionName(int direction);
+
+#endif // DUNGEON_H
@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <string.h>
+#include "entities.h"
+#include "stats.h"
+
+static void *allocateBuffer(uint32_t capacity, size_t size)
+{
+    return statsAlignedAlloc(ENTITY_ALIGNMENT, size * ((size_t)capacity + 1));
+}
+
+int entitiesInit(Entities *entities, uint32_t capacity)
+{
+    memset(entities, 0, sizeof(*entities));
+    entities->health = allocateBuffer(capacity, sizeof(int32_t));
+    entities->maxHealth = allocateBuffer(capacity, sizeof(int32_t));
+    entities->strength = allocateBuffer(capacity, sizeof(int32_t));
+    entities->room = allocateBuffer(capacity, sizeof(int32_t));
+    entities->random = allocateBuffer(capacity, sizeof(uint32_t));
+    entities->state = allocateBuffer(capacity, sizeof(uint8_t));
+    entities->capacity = capacity;
+    entities->rules.regeneration = 1;
+    entities->rules.wanderChance = 65536 / 16;
+    if (!entities->health || !entities->maxHealth || !entities->strength ||
+        !entities->room || !entities->random || !entities->state)
+    {
+        entitiesFree(entities);
+        return -1;
+    }
+    return 0;
+}
+
+void entitiesFree(Entities *entities)
+{
+    free(entities->health);
+    free(entities->maxHealth);
+    free(entities->strength);
+    free(entities->room);
+    free(entities->random);
+    free(entities->state);
+    memset(entities, 0, sizeof(*entities));
+}
+
+static uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+int entitiesSpawn(Entities *entities, int room, int32_t health, int32_t strength, uint32_t seed)
+{
+    if (entities->count >= entities->capacity)
+        return -1;
+    uint32_t i = entities->count++;
+    entities->health[i] = health;
+    entities->maxHealth[i] = health;
+    entities->strength[i] = strength;
+    entities->room[i] = room;
+    entities->random[i] = seed ? seed : 0x9e3779b9u;
+    entities->state[i] = health > 0 ? ENTITY_IDLE : ENTITY_DEAD;
+    return (int)i;
+}
+
+void entitiesPopulate(Entities *entities, const Dungeon *dungeon, uint32_t count, uint64_t seed)
+{
+    // Creature i lands somewhere in the i-th of count equal stretches of
+    // rooms, which spreads them over the world already sorted by room
+    uint64_t rooms = (uint64_t)dungeon->roomCount;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint64_t r = mix(seed + 0x9e3779b97f4a7c15ull * (i + 1));
+        uint64_t stretch = rooms * i / count;
+        uint64_t width = rooms * (i + 1) / count - stretch;
+        int room = (int)(stretch + (width ? (r >> 32) % width : 0));
+        int32_t health = 10 + 5 * (int32_t)((r >> 8) % 19);
+        int32_t strength = 1 + (int32_t)((r >> 16) % 10);
+        if (entitiesSpawn(entities, room, health, strength, (uint32_t)r) < 0)
+            return;
+    }
+}
+
+// Pass 1 of a tick: no branches and no reads outside the buffers, so the
+// loop vectorizes. Conditions are 0 or 1 and combined arithmetically. The
+// buffers are parameters so that restrict tells the compiler they never
+// overlap.
+static void updateAll(uint32_t count, int32_t *restrict health, const int32_t *restrict maxHealth,
+                      const int32_t *restrict strength, const int32_t *restrict room,
+                      uint32_t *restrict random, uint8_t *restrict state,
+                      const EntityRules *rules, int32_t playerRoom, TickResult *result)
+{
+    const int32_t regeneration = rules->regeneration;
+    const uint32_t wanderChance = rules->wanderChance;
+    int64_t damage = 0;
+    int32_t aggressive = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t r = random[i];
+        r ^= r << 13;
+        r ^= r >> 17;
+        r ^= r << 5;
+        random[i] = r;
+
+        int32_t alive = health[i] > 0;
+        int32_t healed = health[i] + regeneration * alive;
+        health[i] = healed < maxHealth[i] ? healed : maxHealth[i];
+
+        int32_t hunting = alive & (room[i] == playerRoom);
+        int32_t wandering = alive & (hunting ^ 1) & ((r & 0xffff) < wanderChance);
+        state[i] = (uint8_t)(alive + wandering + 2 * hunting); // DEAD, IDLE, WANDERING, AGGRESSIVE
+        damage += (int64_t)(hunting * strength[i]);
+        aggressive += hunting;
+    }
+    result->damage = damage;
+    result->aggressive = (uint32_t)aggressive;
+}
+
+void entitiesTick(Entities *entities, const Dungeon *dungeon, int playerRoom, TickResult *result)
+{
+    updateAll(entities->count, entities->health, entities->maxHealth, entities->strength, entities->room,
+              entities->random, entities->state, &entities->rules, playerRoom, result);
+
+    // Pass 2: wanderers take a random exit; creatures have no keys, so
+    // gates stop them
+    uint32_t moved = 0;
+    for (uint32_t i = 0; i < entities->count; i++)
+    {
+        if (entities->state[i] != ENTITY_WANDERING)
+            continue;
+        int from = entities->room[i];
+        int direction = (int)((entities->random[i] >> 16) % DIR_COUNT);
+        int to = dungeonRoom(dungeon, from)->exits[direction];
+        if (to < 0 || to >= dungeon->roomCount || dungeonExitGate(dungeon, from, direction))
+            continue;
+        entities->room[i] = to;
+        moved++;
+    }
+    result->moved = moved;
+}
+
+int32_t entitiesHit(Entities *entities, uint32_t index, int32_t damage)
+{
+    if (index >= entities->count || entities->health[index] <= 0)
+        return 0;
+    entities->health[index] -= damage;
+    if (entities->health[index] <= 0)
+    {
+        entities->health[index] = 0;
+        entities->state[index] = ENTITY_DEAD;
+    }
+    return entities->health[index];
+}
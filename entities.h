@@ -0,0 +1,80 @@
+#ifndef ENTITIES_H
+#define ENTITIES_H
+
+#include <stdint.h>
+#include "dungeon.h"
+
+// Wandering creatures. Every attribute is an array of its own (structure of
+// arrays), so a tick streams through a few contiguous buffers instead of
+// chasing per-creature records, and the per-creature arithmetic compiles to
+// SIMD loops.
+//
+// A tick has two passes. The first is branch-free and vectorizable: every
+// creature advances its random stream, regenerates up to its maximum
+// health, turns aggressive when it shares the player's room (adding its
+// strength to the damage the player takes) and otherwise decides whether to
+// wander. The second pass moves the wanderers through a random open exit of
+// their room; it is the only one that reads rooms, and since creatures are
+// kept in room order it walks the dungeon mostly front to back.
+//
+// Creatures are independent of the rooms' own creatures in the dungeon
+// file. Ticks only depend on the seed, so runs can be replayed.
+
+enum EntityState
+{
+    ENTITY_DEAD,
+    ENTITY_IDLE,
+    ENTITY_WANDERING, // Moves on in the second pass of the tick
+    ENTITY_AGGRESSIVE // In the player's room, attacking
+};
+
+#define ENTITY_ALIGNMENT 64 // Buffers start on a cache line
+
+typedef struct EntityRules
+{
+    int32_t regeneration; // Health regained per tick, up to maxHealth
+    uint32_t wanderChance; // Out of 65536, per tick
+} EntityRules;
+
+typedef struct Entities
+{
+    int32_t *health;
+    int32_t *maxHealth;
+    int32_t *strength;
+    int32_t *room;
+    uint32_t *random; // xorshift32 state of each creature, never 0
+    uint8_t *state;   // EntityState
+    uint32_t count;
+    uint32_t capacity;
+    EntityRules rules;
+} Entities;
+
+// What a tick did
+typedef struct TickResult
+{
+    int64_t damage;      // Strength of all aggressive creatures together
+    uint32_t aggressive; // Creatures in the player's room
+    uint32_t moved;      // Creatures that went through an exit
+} TickResult;
+
+// Prepare room for capacity creatures. Returns 0 on success, -1 if memory
+// runs out.
+int entitiesInit(Entities *entities, uint32_t capacity);
+void entitiesFree(Entities *entities);
+
+// Add a creature, returns its index or -1 if the buffers are full
+int entitiesSpawn(Entities *entities, int room, int32_t health, int32_t strength, uint32_t seed);
+
+// Fill the buffers with creatures in random rooms of the dungeon, in room
+// order. Health and strength are drawn from the ranges used by the
+// generator.
+void entitiesPopulate(Entities *entities, const Dungeon *dungeon, uint32_t count, uint64_t seed);
+
+// Advance every creature by one tick. playerRoom is where aggression
+// happens, -1 for nowhere.
+void entitiesTick(Entities *entities, const Dungeon *dungeon, int playerRoom, TickResult *result);
+
+// Deal damage to a creature, returns its health left
+int32_t entitiesHit(Entities *entities, uint32_t index, int32_t damage);
+
+#endif // ENTITIES_H
@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+#include "generate.h"
+#include "hwdec12.h"
+#include "stats.h"
+
+#define GENERATOR_STRING_BYTES 4096
+#define GATE_BONUS 5 // Strength gained passing a gate
+
+static const char *descriptions[] = {
+    "A damp stone chamber. Water drips from the ceiling.",
+    "A narrow hall lined with broken statues.",
+    "A cellar that smells of old wine and mould.",
+    "A round room with a cold, empty fireplace.",
+    "A guard room. Rusty weapons hang on the walls.",
+    "A collapsed library, pages scattered across the floor.",
+    "A crypt with rows of sealed stone coffins.",
+    "A cave where roots break through the walls.",
+    "A shrine to a forgotten god, its altar cracked.",
+    "A storeroom full of rotten crates.",
+    "A bridge over a dark, rushing stream.",
+    "A torture chamber. You try not to look too closely.",
+    "A kitchen with a cauldron still warm to the touch.",
+    "A mushroom grove glowing a faint green.",
+    "A barracks with rows of mouldy bunks.",
+    "A hall of mirrors, most of them shattered.",
+};
+#define DESCRIPTION_COUNT (int)(sizeof(descriptions) / sizeof(descriptions[0]))
+
+static const char *creatures[] = {"Rat", "Bat", "Goblin", "Skeleton", "Spider", "Orc", "Wraith", "Troll"};
+#define CREATURE_COUNT (int)(sizeof(creatures) / sizeof(creatures[0]))
+
+static const char *loot[] = {"Gem", "Coin", "Potion", "Scroll", "Dagger", "Shield", "Torch", "Rope"};
+#define LOOT_COUNT (int)(sizeof(loot) / sizeof(loot[0]))
+
+static const char *keys[GENERATOR_MAX_KEYS] = {"Brass Key", "Iron Key", "Silver Key", "Gold Key"};
+static const char *keyMessages[GENERATOR_MAX_KEYS] = {
+    "A door with a brass lock bars the way down.",
+    "A door with an iron lock bars the way down.",
+    "A door with a silver lock bars the way down.",
+    "A door with a gold lock bars the way down.",
+};
+
+typedef struct Strings
+{
+    char *bytes;
+    uint32_t size;
+} Strings;
+
+// Append a string to the string table, 0 ("") if the table is full
+static uint32_t addString(Strings *strings, const char *text)
+{
+    size_t length = strlen(text) + 1;
+    if (strings->size + length > GENERATOR_STRING_BYTES)
+        return 0;
+    uint32_t offset = strings->size;
+    memcpy(strings->bytes + offset, text, length);
+    strings->size += (uint32_t)length;
+    return offset;
+}
+
+static uint64_t nextRandom(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Uniform random number in [0, n)
+static uint32_t below(uint64_t *state, uint32_t n)
+{
+    return (uint32_t)(((nextRandom(state) >> 32) * n) >> 32);
+}
+
+static int chance(uint64_t *state, int percent)
+{
+    return (int)below(state, 100) < percent;
+}
+
+static void connectRooms(DungeonRoom *rooms, int from, int direction, int to)
+{
+    static const int opposite[DIR_COUNT] = {DIR_DOWN, DIR_UP, DIR_RIGHT, DIR_LEFT};
+    rooms[from].exits[direction] = to;
+    rooms[to].exits[opposite[direction]] = from;
+}
+
+// First row of a band
+static int bandStart(const GeneratorConfig *config, int band)
+{
+    return (int)((int64_t)config->height * band / (config->gates + 1));
+}
+
+void generatorDefaults(GeneratorConfig *config)
+{
+    config->seed = 1;
+    config->width = 100;
+    config->height = 100;
+    config->gates = 8;
+    config->loopPercent = 10;
+    config->creaturePercent = 5;
+    config->itemPercent = 3;
+}
+
+int dungeonGenerate(const GeneratorConfig *config, DungeonImage *image)
+{
+    memset(image, 0, sizeof(*image));
+    int width = config->width;
+    int height = config->height;
+    int gates = config->gates;
+    if (width < 1 || height < 1 || (int64_t)width * height > INT32_MAX ||
+        gates < 0 || gates >= height || gates > DUNGEON_MAX_REQUIREMENTS)
+        return -1;
+
+    size_t roomCount = (size_t)width * (size_t)height;
+    DungeonRoom *rooms = statsMalloc(sizeof(DungeonRoom) * roomCount);
+    uint16_t *slots = statsMalloc(sizeof(uint16_t) * (roomCount + GENERATOR_MAX_KEYS));
+    DungeonGate *gateTable = statsCalloc((size_t)gates + 1, sizeof(DungeonGate));
+    DungeonRequirement *requirements = statsCalloc((size_t)gates + 1, sizeof(DungeonRequirement));
+    DungeonVariant *variants = statsCalloc((size_t)gates + 1, sizeof(DungeonVariant));
+    uint32_t *itemNames = statsMalloc(sizeof(uint32_t) * (LOOT_COUNT + GENERATOR_MAX_KEYS));
+    int *special = statsMalloc(sizeof(int) * ((size_t)gates + 1));  // Key or guardian room of each band
+    int *crossing = statsMalloc(sizeof(int) * ((size_t)gates + 1)); // Column of the passage into each band
+    Strings strings = {statsCalloc(GENERATOR_STRING_BYTES, 1), 1};
+    if (!rooms || !slots || !gateTable || !requirements || !variants || !itemNames || !special || !crossing ||
+        !strings.bytes)
+    {
+        free(rooms);
+        free(slots);
+        free(gateTable);
+        free(requirements);
+        free(variants);
+        free(itemNames);
+        free(special);
+        free(crossing);
+        free(strings.bytes);
+        return -1;
+    }
+
+    uint32_t descriptionStrings[DESCRIPTION_COUNT];
+    uint32_t creatureStrings[CREATURE_COUNT];
+    for (int i = 0; i < DESCRIPTION_COUNT; i++)
+        descriptionStrings[i] = addString(&strings, descriptions[i]);
+    for (int i = 0; i < CREATURE_COUNT; i++)
+        creatureStrings[i] = addString(&strings, creatures[i]);
+    for (int i = 0; i < LOOT_COUNT; i++)
+        itemNames[i] = addString(&strings, loot[i]);
+    uint32_t guardianString = addString(&strings, "Guardian");
+    uint32_t bossString = addString(&strings, "Dragon");
+    uint32_t sealedString = addString(&strings, "A sealed door bars the way down. Its guardian still lives.");
+    uint32_t openString = addString(&strings, "A door in the floor stands open, stairs lead down into the dark.");
+
+    // The gates come first: band b holds what opens the passage into band
+    // b + 1. Keys alternate with guardians as long as keys are left.
+    uint64_t rng = config->seed;
+    int keyCount = 0;
+    int strength = PLAYER_STRENGTH;
+    for (int b = 0; b < gates; b++)
+    {
+        int top = bandStart(config, b);
+        int rows = bandStart(config, b + 1) - top;
+        special[b] = (top + (int)below(&rng, (uint32_t)rows)) * width + (int)below(&rng, (uint32_t)width);
+        crossing[b] = (int)below(&rng, (uint32_t)width);
+
+        DungeonGate *gate = &gateTable[b];
+        gate->direction = DIR_DOWN;
+        gate->requirement = (uint32_t)b;
+        gate->strengthBonus = GATE_BONUS;
+        // Once the gate opens, its room says so
+        variants[b].requires = 1ull << b;
+        variants[b].description = openString;
+        if (b % 2 == 0 && keyCount < GENERATOR_MAX_KEYS)
+        {
+            itemNames[LOOT_COUNT + keyCount] = addString(&strings, keys[keyCount]);
+            requirements[b].kind = REQUIRE_ITEM;
+            requirements[b].value = (uint32_t)(LOOT_COUNT + keyCount);
+            gate->message = addString(&strings, keyMessages[keyCount]);
+            keyCount++;
+        }
+        else
+        {
+            requirements[b].kind = REQUIRE_KILL;
+            requirements[b].value = (uint32_t)special[b];
+            gate->message = sealedString;
+        }
+    }
+
+    uint32_t slotCount = 0;
+    int band = 0;
+    int bandTop = 0;
+    int nextBand = gates > 0 ? bandStart(config, 1) : height;
+    for (int y = 0; y < height; y++)
+    {
+        if (y == nextBand)
+        {
+            band++;
+            bandTop = y;
+            nextBand = band < gates ? bandStart(config, band + 1) : height;
+        }
+        for (int x = 0; x < width; x++)
+        {
+            int index = y * width + x;
+            DungeonRoom *room = &rooms[index];
+            room->description = descriptionStrings[below(&rng, DESCRIPTION_COUNT)];
+            for (int d = 0; d < DIR_COUNT; d++)
+                room->exits[d] = DUNGEON_NO_ROOM;
+            room->firstSlot = slotCount;
+            room->itemCount = 0;
+            room->creature = 0;
+            room->creatureHealth = 0;
+            room->firstGate = 0;
+            room->gateCount = 0;
+            room->firstVariant = 0;
+            room->variantCount = 0;
+
+            // Binary tree maze within the band: every room links up or
+            // left, which connects the whole band, and sometimes both,
+            // which adds loops.
+            int canUp = y > bandTop;
+            int canLeft = x > 0;
+            if (canUp && canLeft)
+            {
+                int up = (int)below(&rng, 2);
+                connectRooms(rooms, index, up ? DIR_UP : DIR_LEFT, up ? index - width : index - 1);
+                if (chance(&rng, config->loopPercent))
+                    connectRooms(rooms, index, up ? DIR_LEFT : DIR_UP, up ? index - 1 : index - width);
+            }
+            else if (canUp)
+                connectRooms(rooms, index, DIR_UP, index - width);
+            else if (canLeft)
+                connectRooms(rooms, index, DIR_LEFT, index - 1);
+
+            if (band > 0 && y == bandTop && x == crossing[band - 1])
+            {
+                connectRooms(rooms, index, DIR_UP, index - width);
+                rooms[index - width].firstGate = (uint32_t)(band - 1);
+                rooms[index - width].gateCount = 1;
+                rooms[index - width].firstVariant = (uint32_t)(band - 1);
+                rooms[index - width].variantCount = 1;
+            }
+
+            if (chance(&rng, config->creaturePercent))
+            {
+                room->creature = creatureStrings[below(&rng, CREATURE_COUNT)];
+                room->creatureHealth = 10 + 5 * (int32_t)below(&rng, 19);
+            }
+            if (chance(&rng, config->itemPercent))
+            {
+                slots[slotCount++] = (uint16_t)below(&rng, LOOT_COUNT);
+                room->itemCount++;
+            }
+
+            if (band < gates && index == special[band])
+            {
+                if (requirements[band].kind == REQUIRE_ITEM)
+                {
+                    slots[slotCount++] = (uint16_t)requirements[band].value;
+                    room->itemCount++;
+                }
+                else
+                {
+                    // A guardian falls to one blow from a player who came
+                    // straight through the gates above.
+                    room->creature = guardianString;
+                    room->creatureHealth = strength;
+                }
+            }
+        }
+        if (band < gates && y == nextBand - 1)
+            strength += GATE_BONUS;
+    }
+
+    // The goal creature takes three blows from such a player
+    int goal = (int)roomCount - 1;
+    rooms[goal].creature = bossString;
+    rooms[goal].creatureHealth = 3 * strength;
+
+    free(special);
+    free(crossing);
+    image->startRoom = 0;
+    image->goalRoom = goal;
+    image->rooms = rooms;
+    image->roomCount = (uint32_t)roomCount;
+    image->itemNames = itemNames;
+    image->itemCount = (uint32_t)(LOOT_COUNT + keyCount);
+    image->slots = slots;
+    image->slotCount = slotCount;
+    image->gates = gateTable;
+    image->gateCount = (uint32_t)gates;
+    image->requirements = requirements;
+    image->requirementCount = (uint32_t)gates;
+    image->variants = variants;
+    image->variantCount = (uint32_t)gates;
+    image->strings = strings.bytes;
+    image->stringBytes = strings.size;
+    return 0;
+}
+
+void dungeonImageFree(DungeonImage *image)
+{
+    free((void *)image->rooms);
+    free((void *)image->itemNames);
+    free((void *)image->slots);
+    free((void *)image->gates);
+    free((void *)image->requirements);
+    free((void *)image->variants);
+    free((void *)image->strings);
+    memset(image, 0, sizeof(*image));
+}
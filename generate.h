@@ -0,0 +1,39 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <stdint.h>
+#include "dungeon.h"
+
+// Procedural grid dungeons. The world is a width x height grid of rooms cut
+// into horizontal bands, one more than there are gates. Every band is a
+// maze that connects all of its rooms; consecutive bands are joined by one
+// gated passage that opens with a key lying in the band above or once the
+// band's guardian is dead. The player starts in the top-left room and the
+// goal creature waits in the bottom-right one, so every generated dungeon can
+// be won. The same configuration always yields the same dungeon.
+
+#define GENERATOR_MAX_KEYS 4 // Item gates, kept below the inventory capacity
+
+typedef struct GeneratorConfig
+{
+    uint64_t seed;
+    int width;           // Rooms per row
+    int height;          // Rows
+    int gates;           // Gated passages between bands
+    int loopPercent;     // Chance of a room having a second maze link
+    int creaturePercent; // Chance of a room having a wandering creature
+    int itemPercent;     // Chance of a room having a loot item
+} GeneratorConfig;
+
+// Fill in the default configuration: a 100 x 100 grid with 8 gates
+void generatorDefaults(GeneratorConfig *config);
+
+// Generate a dungeon. The image's arrays are allocated and released with
+// dungeonImageFree. Returns 0 on success, -1 if the configuration is invalid
+// or memory runs out.
+int dungeonGenerate(const GeneratorConfig *config, DungeonImage *image);
+
+// Release a generated image
+void dungeonImageFree(DungeonImage *image);
+
+#endif // GENERATE_H
@@ -1,461 +1,636 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <strings.h> // For strcasecmp()
+#include <unistd.h>
 #include "hwdec12.h"
-
-
-#define MAX_ROOMS 5
-#define MAX_ITEMS 5
-#define INVENTORY_CAPACITY 5
-#define MAX_INPUT_SIZE 100
-
-// Global Variables
-Room rooms[MAX_ROOMS];
-Player player;
+#include "roomcache.h"
+#include "stats.h"
+#include "snapshot.h"
+#include "output.h"
+#include "combat.h"
 
 // Function Prototypes
-void initializeGame();
-void freeResources();
-void loadRooms();
-void save(const char *filepath);
-void move(Player *player, Room rooms[], const char *direction);
-void look(const Player *player, const Room rooms[]);
-void inventory(const Player *player);
-void pickup(Player *player, Room *room, const char *itemName);
-void attack(Player *player, Room *room);
-void handleCommand(Player *player, Room rooms[], char *command);
+int initializeGame(GameState *game, const Dungeon *dungeon);
+int newGame(GameState *game, const Dungeon *dungeon);
+void freeResources(GameState *game);
+int loadRooms(Dungeon *dungeon, const char *dungeonPath);
+void save(GameState *game, const char *filepath);
+void backgroundSave(GameState *game, const char *filepath);
+void load(GameState *game, const char *filepath);
+void exportText(GameState *game, const char *filepath);
+void move(GameState *game, const char *direction);
+void travel(GameState *game, const char *room);
+void look(GameState *game);
+void inventory(GameState *game);
+void pickup(GameState *game, const char *itemName);
+int attack(GameState *game);
+int handleCommand(GameState *game, char *command);
+int runCommand(GameState *game, const ParsedCommand *command);
 void toLowerCase(char *str);
 // Initialize Game Data
-void initializeGame()
-{
-    printf("Welcome to the Text Adventure Game!\n");
-    printf("Type 'help' for a list of commands.\n");
-    player.health = 100;
-    player.strength = 15;
-    player.inventoryCapacity = INVENTORY_CAPACITY;
-    player.inventoryCount = 0;
-    player.inventory = malloc(sizeof(char *) * INVENTORY_CAPACITY);
-    player.currentRoom = 0;
-    player.hasVisitedTreasureRoom = 0; // Initially, the player hasn't visited the Treasure Room.
-    player.hasKilledGoblin = 0;        // Initially, the player hasn't killed the goblin.
-    player.hasArmor = 0;               // Initially the player hsn't have armor
-    player.hasKilledWitch = 0;
-    player.hasKilledFinalBoss = 0;
-
-    loadRooms();
-}
-
-void loadRooms()
-{
-    for (int i = 0; i < MAX_ROOMS; i++)
-    {
-        rooms[i].description = malloc(100);
-        sprintf(rooms[i].description, "Room %d description.", i);
-        rooms[i].up = rooms[i].down = rooms[i].left = rooms[i].right = -1;
-        rooms[i].items = malloc(sizeof(char *) * MAX_ITEMS);
-        rooms[i].itemCount = 0;
-        rooms[i].creature = NULL;
-        rooms[i].creatureHealth = 0;
-    }
-
-    // Room 0: Dungeon Entrance
-    strcpy(rooms[0].description, "You are in the Dungeon Entrance. A sword lies on the ground.");
-    rooms[0].right = 1; // Can go to Room 1
-    rooms[0].items[rooms[0].itemCount++] = strdup("Sword");
-
-    // Room 1: Goblins' Hell
-    strcpy(rooms[1].description, "You are in Goblins' Hell. A goblin is here, ready to attack!");
-    rooms[1].left = 0;  // Can go back to Room 0 (left)
-    rooms[1].down = 3;  // Can go down to Room 3 (Treasure Room)
-    rooms[1].up = 2;    // Can go up to Room 2 (Witch's Holley)
-    rooms[1].right = 4; // Can go right to Room 4 (Final Boss)
-    rooms[1].creature = strdup("Goblin");
-    rooms[1].creatureHealth = 60;
-
-    // Room 2: Witch's Holley
-    strcpy(rooms[2].description, "You are in Witch's Holley. A scary witch looms over you, cackling!");
-    rooms[2].down = 1;   // You can go down to Room 1 (Goblins' Hell)
-    rooms[2].up = -1;    // No room above
-    rooms[2].left = -1;  // No room to the left
-    rooms[2].right = -1; // No room to the right
-    rooms[2].creature = strdup("Witch");
-    rooms[2].items[rooms[2].itemCount++] = strdup("Key");
-    rooms[2].creatureHealth = 100;
-
-    // Room 3: Treasure Room
-    strcpy(rooms[3].description, "You are in the Treasure Room. Glittering treasures are everywhere!");
-    rooms[3].up = 1;     // You can go up to Room 1 (Goblins' Hell)
-    rooms[3].down = -1;  // No room below
-    rooms[3].left = -1;  // No room to the left
-    rooms[3].right = -1; // No room to the right
-    rooms[3].items[rooms[3].itemCount++] = strdup("Armor");
-
-    // Room 4: Final Boss
-    strcpy(rooms[4].description, "You are in the Final Boss room. The final boss awaits!");
-    rooms[4].up = -1;    // No room above
-    rooms[4].down = -1;  // No room below
-    rooms[4].left = 1;   // Can go left to Room 1 (Goblins' Hell) to escape
-    rooms[4].right = -1; // No room to the right
-    rooms[4].creature = strdup("Final Boss");
-    rooms[4].creatureHealth = 300;
+int initializeGame(GameState *game, const Dungeon *dungeon)
+{
+    if (newGame(game, dungeon) != 0)
+        return -1;
+
+    sinkPrintf(&game->out, "Welcome to the Text Adventure Game!\n");
+    sinkPrintf(&game->out, "Type 'help' for a list of commands.\n");
+    return 0;
+}
+
+// Start a new game in the loaded dungeon
+int newGame(GameState *game, const Dungeon *dungeon)
+{
+    Player *player = &game->player;
+    game->dungeon = dungeon;
+
+    // Rooms start out exactly as in the dungeon file, so a new session has
+    // no room state at all until the player changes something.
+    // Dropping the old session's rooms is one arena reset. The inventory is
+    // a bitset over all interned items; for any dungeon with up to 128
+    // distinct items it lives inside the Player itself.
+    if (game->arena.blockSize == 0)
+        arenaInit(&game->arena, SESSION_ARENA_BLOCK);
+    else
+        arenaReset(&game->arena);
+    roomTableInit(&game->rooms, &game->arena);
+    roomViewsInit(&game->views, &game->arena);
+    snapshotForgetSave(game);
+    itemSetFree(&player->inventory);
+    if (itemSetInit(&player->inventory, itemCount()) != 0)
+        return -1;
+
+    player->health = PLAYER_HEALTH;
+    player->strength = PLAYER_STRENGTH;
+    player->inventoryCapacity = INVENTORY_CAPACITY;
+    player->inventoryCount = 0;
+    player->currentRoom = dungeon->header->startRoom;
+    game->capabilities = gameCapabilities(game);
+    return 0;
+}
+
+int loadRooms(Dungeon *dungeon, const char *dungeonPath)
+{
+    return dungeonOpenPaged(dungeon, dungeonPath, ROOM_CACHE_DEFAULT_CHUNKS);
+}
+
+// Room accessors: the static part comes from the dungeon file, the rest
+// from the session's room state.
+static const DungeonRoom *roomAt(const GameState *game, int room)
+{
+    return dungeonRoom(game->dungeon, room);
+}
+
+static const RoomState *roomState(const GameState *game, int room)
+{
+    static const RoomState untouched;
+    const RoomState *state = roomTableFind(&game->rooms, room);
+    return state ? state : &untouched;
+}
+
+static RoomState *changeRoom(GameState *game, int room)
+{
+    // If the table cannot grow the change is dropped rather than crashing
+    static RoomState scratch;
+    roomViewInvalidate(&game->views, room);
+    RoomState *state = roomTableGet(&game->rooms, room);
+    if (!state)
+        return &scratch;
+    state->dirty = 1;
+    return state;
+}
+
+static int creatureHealth(const GameState *game, int room)
+{
+    return roomAt(game, room)->creatureHealth - roomState(game, room)->creatureDamage;
+}
+
+// Name of the living creature in a room, NULL if there is none
+static const char *roomCreature(const GameState *game, int room)
+{
+    if (roomAt(game, room)->creature == 0 || creatureHealth(game, room) <= 0)
+        return NULL;
+    return dungeonString(game->dungeon, roomAt(game, room)->creature);
+}
+
+static int roomHasItem(const GameState *game, int room, int slot)
+{
+    return !(roomState(game, room)->itemsTaken & (1ull << slot));
+}
+
+static ItemId roomItem(const GameState *game, int room, int slot)
+{
+    return dungeonRoomItemId(game->dungeon, roomAt(game, room), slot);
+}
+
+static const char *roomItemName(const GameState *game, int room, int slot)
+{
+    return itemName(roomItem(game, room, slot));
+}
+
+static int roomItemCount(const GameState *game, int room)
+{
+    int count = 0;
+    for (int i = 0; i < dungeonRoomItemCount(roomAt(game, room)); i++)
+        count += roomHasItem(game, room, i);
+    return count;
 }
 
 // Free allocated resources
-void freeResources()
+void freeResources(GameState *game)
+{
+    arenaFree(&game->arena);
+    roomTableInit(&game->rooms, &game->arena);
+    roomViewsInit(&game->views, &game->arena);
+    itemSetFree(&game->player.inventory);
+    backgroundSaveFree(&game->background);
+    snapshotForgetSave(game);
+}
+
+// Save game state to a file
+void save(GameState *game, const char *filepath)
 {
-    for (int i = 0; i < MAX_ROOMS; i++)
+    if (backgroundSaveRunning(&game->background, filepath))
     {
-        free(rooms[i].description);
-        for (int j = 0; j < rooms[i].itemCount; j++)
-            free(rooms[i].items[j]);
-        free(rooms[i].items);
-        if (rooms[i].creature)
-            free(rooms[i].creature);
+        sinkPrintf(&game->out, "A background save to %s is still running.\n", filepath);
+        return;
+    }
+    if (snapshotSaveIncremental(filepath, game) != 0)
+    {
+        sinkPrintf(&game->out, "Error opening file for saving.\n");
     }
-    for (int i = 0; i < player.inventoryCount; i++)
-        free(player.inventory[i]);
-    free(player.inventory);
 }
 
-// Save game state to a file
-void save(const char *filepath)
+void backgroundSave(GameState *game, const char *filepath)
+{
+    // The child replaces the file, so deltas must not be appended to it
+    if (game->saved.path && strcmp(game->saved.path, filepath) == 0)
+        snapshotForgetSave(game);
+    int result = backgroundSaveStart(&game->background, game, filepath);
+    if (result == 1)
+        sinkPrintf(&game->out, "A background save is still running.\n");
+    else if (result != 0)
+        sinkPrintf(&game->out, "Error starting the background save.\n");
+    else
+        sinkPrintf(&game->out, "Saving to %s in the background.\n", filepath);
+}
+
+// Report a background save that finished since the last command
+static void reportBackgroundSave(GameState *game)
 {
+    BackgroundSaveResult result;
+    if (!backgroundSavePoll(&game->background, 0, &result))
+        return;
+    if (result.failed)
+        sinkPrintf(&game->out, "Background save to %s failed.\n", result.path);
+    else
+        sinkPrintf(&game->out, "Background save to %s finished in %.2f ms (%.2f ms of it in the game).\n",
+                   result.path, (result.pauseNs + result.writeNs) / 1e6, result.pauseNs / 1e6);
+}
+
+// Load game state from a file written by save()
+void load(GameState *game, const char *filepath)
+{
+    if (backgroundSaveRunning(&game->background, filepath))
+    {
+        sinkPrintf(&game->out, "A background save to %s is still running.\n", filepath);
+        return;
+    }
+    int result = snapshotLoad(filepath, game);
+    game->capabilities = gameCapabilities(game);
+    if (result == -1)
+    {
+        sinkPrintf(&game->out, "Error opening file for loading.\n");
+    }
+    else if (result != 0)
+    {
+        sinkPrintf(&game->out, "%s is not a valid save file for this dungeon.\n", filepath);
+    }
+}
+
+// Export the game state as readable text
+void exportText(GameState *game, const char *filepath)
+{
+    const Dungeon *dungeon = game->dungeon;
+    const Player *player = &game->player;
     FILE *file = fopen(filepath, "w");
     if (file == NULL)
     {
-        printf("Error opening file for saving.\n");
+        sinkPrintf(&game->out, "Error opening file for exporting.\n");
         return;
     }
 
     // Save player data
-    fprintf(file, "Player Health: %d\n", player.health);
-    fprintf(file, "Player Strength: %d\n", player.strength);
-    fprintf(file, "Inventory Capacity: %d\n", player.inventoryCapacity);
-    fprintf(file, "Inventory Count: %d\n", player.inventoryCount);
-    fprintf(file, "Current Room: %d\n", player.currentRoom);
-    fprintf(file, "Has Visited Treasure Room: %d\n", player.hasVisitedTreasureRoom);
-    fprintf(file, "Has Killed Goblin: %d\n", player.hasKilledGoblin);
-    fprintf(file, "Has Killed Witch: %d\n", player.hasKilledWitch);
-    fprintf(file, "Has Killed Final Boss: %d\n", player.hasKilledFinalBoss);
-    
+    fprintf(file, "Player Health: %d\n", player->health);
+    fprintf(file, "Player Strength: %d\n", player->strength);
+    fprintf(file, "Inventory Capacity: %d\n", player->inventoryCapacity);
+    fprintf(file, "Inventory Count: %d\n", player->inventoryCount);
+    fprintf(file, "Current Room: %d\n", player->currentRoom);
 
     // Save inventory items
     fprintf(file, "Inventory:\n");
-    for (int i = 0; i < player.inventoryCount; i++)
+    int number = 1;
+    for (ItemId id = itemSetNext(&player->inventory, 0); id != ITEM_NONE; id = itemSetNext(&player->inventory, id + 1))
     {
-        fprintf(file, "  Item %d: %s\n", i + 1, player.inventory[i]);
+        fprintf(file, "  Item %d: %s\n", number++, itemName(id));
     }
 
     // Save room data
-    for (int i = 0; i < MAX_ROOMS; i++)
+    for (int i = 0; i < dungeon->roomCount; i++)
     {
+        const DungeonRoom *room = roomAt(game, i);
+        const char *creature = roomCreature(game, i);
         fprintf(file, "Room %d:\n", i);
-        fprintf(file, "  Description: %s\n", rooms[i].description);
-        fprintf(file, "  Creature: %s (Health: %d)\n", rooms[i].creature ? rooms[i].creature : "None", rooms[i].creatureHealth);
-        fprintf(file, "  Item Count: %d\n", rooms[i].itemCount);
+        fprintf(file, "  Description: %s\n", dungeonDescription(dungeon, room, game->capabilities));
+        fprintf(file, "  Creature: %s (Health: %d)\n", creature ? creature : "None", creatureHealth(game, i));
+        fprintf(file, "  Item Count: %d\n", roomItemCount(game, i));
 
         // Save items in the room
         fprintf(file, "  Items:\n");
-        for (int j = 0; j < rooms[i].itemCount; j++)
+        for (int j = 0; j < dungeonRoomItemCount(room); j++)
         {
-            fprintf(file, "    %s\n", rooms[i].items[j]);
+            if (roomHasItem(game, i, j))
+                fprintf(file, "    %s\n", roomItemName(game, i, j));
         }
 
         // Save room connections
         fprintf(file, "  Connections: Up: %d, Down: %d, Left: %d, Right: %d\n",
-                rooms[i].up, rooms[i].down, rooms[i].left, rooms[i].right);
+                room->exits[DIR_UP], room->exits[DIR_DOWN], room->exits[DIR_LEFT], room->exits[DIR_RIGHT]);
     }
 
     fclose(file);
 }
-void load(const char *filepath)
+
+// Check if the player has a specific item in their inventory
+// Helper function to check if an item is in the player's inventory
+int hasItemInInventory(const Player *player, const char *item)
+{
+    // One hash lookup for the id and one bit test, whatever the inventory size
+    return itemSetHas(&player->inventory, itemFind(item));
+}
+
+// Take one exit of the current room, if its gate lets the player through
+static void moveDirection(GameState *game, int direction)
 {
-    FILE *file = fopen(filepath, "r");
-    if (file == NULL)
+    Player *player = &game->player;
+
+    // Get the current room
+    const DungeonRoom *currentRoom = roomAt(game, player->currentRoom);
+    int nextRoom = -1;
+    if (direction >= 0 && direction < DIR_COUNT)
     {
-        printf("Error opening file for loading.\n");
-        return;
+        nextRoom = currentRoom->exits[direction];
     }
 
-    char line[MAX_INPUT_SIZE];
-    while (fgets(line, sizeof(line), file))
-    {
-        // Load player data
-        if (strncmp(line, "Player Health:", 14) == 0)
-            sscanf(line, "Player Health: %d", &player.health);
-        else if (strncmp(line, "Player Strength:", 16) == 0)
-            sscanf(line, "Player Strength: %d", &player.strength);
-        else if (strncmp(line, "Inventory Capacity:", 19) == 0)
-            sscanf(line, "Inventory Capacity: %d", &player.inventoryCapacity);
-        else if (strncmp(line, "Inventory Count:", 16) == 0)
-            sscanf(line, "Inventory Count: %d", &player.inventoryCount);
-        else if (strncmp(line, "Current Room:", 13) == 0)
-            sscanf(line, "Current Room: %d", &player.currentRoom);
-        else if (strncmp(line, "Has Visited Treasure Room:", 26) == 0)
-            sscanf(line, "Has Visited Treasure Room: %d", &player.hasVisitedTreasureRoom);
-        else if (strncmp(line, "Has Killed Goblin:", 18) == 0)
-            sscanf(line, "Has Killed Goblin: %d", &player.hasKilledGoblin);
-        else if (strncmp(line, "Inventory:", 10) == 0)
-        {
-            // Load inventory items
-            while (fgets(line, sizeof(line), file) && line[0] != '\n')
-            {
-                char *item = malloc(MAX_INPUT_SIZE);
-                sscanf(line, "  Item %*d: %s", item);
-                player.inventory[player.inventoryCount++] = item;
-            }
-        }
-        else if (strncmp(line, "Room", 4) == 0)
-        {
-            int roomIndex;
-            sscanf(line, "Room %d:", &roomIndex);
-            fgets(line, sizeof(line), file); // Skip description line
-            fgets(line, sizeof(line), file); // Skip creature line
-            sscanf(line, "  Creature: %*s (Health: %d)", &rooms[roomIndex].creatureHealth);
-            fgets(line, sizeof(line), file); // Skip item count line
-            while (fgets(line, sizeof(line), file) && line[0] != '\n')
-            {
-                char *item = malloc(MAX_INPUT_SIZE);
-                sscanf(line, "    Item: %s", item);
-                rooms[roomIndex].items[rooms[roomIndex].itemCount++] = item;
-            }
-        }
+    // Check if the direction is valid
+    if (nextRoom < 0 || nextRoom >= game->dungeon->roomCount)
+    {
+        sinkPrintf(&game->out, "You can't go that way.\n");
+        return;
     }
 
-    fclose(file);
-}
-// Check if the player has a specific item in their inventory
-// Helper function to check if an item is in the player's inventory
-int hasItemInInventory(const char *item)
-{
-    for (int i = 0; i < player.inventoryCount; i++)
+    // Locked exits come from the dungeon file, each with its own message
+    const DungeonGate *gate = dungeonExitGate(game->dungeon, player->currentRoom, direction);
+    if (gate)
     {
-        if (strcasecmp(player.inventory[i], item) == 0)
+        if (!((game->capabilities >> gate->requirement) & 1))
         {
-            return 1; // Item found in inventory
+            const char *message = dungeonString(game->dungeon, gate->message);
+            sinkPrintf(&game->out, "%s\n", *message ? message : "The way is locked.");
+            return;
         }
+        player->strength += gate->strengthBonus;
     }
-    return 0; // Item not found
+
+    // Move the player to the next room
+    player->currentRoom = nextRoom;
+    sinkPrintf(&game->out, "You move to Room %d.\n", player->currentRoom);
 }
 
 // Function to handle movement
-void move(Player *player, Room rooms[], const char *direction)
+void move(GameState *game, const char *direction)
 {
-    // Get the current room
-    Room *currentRoom = &rooms[player->currentRoom];
-    int nextRoom = -1;
+    moveDirection(game, directionFromName(direction));
+}
 
-    // Check the direction and determine the next room
-    if (strcasecmp(direction, "right") == 0)
-    {
-        nextRoom = currentRoom->right;
-    }
-    else if (strcasecmp(direction, "left") == 0)
-    {
-        nextRoom = currentRoom->left;
-    }
-    else if (strcasecmp(direction, "up") == 0)
+// Goto command: walk the shortest route the player's gates allow
+void travel(GameState *game, const char *room)
+{
+    char *end;
+    long target = strtol(room, &end, 10);
+    if (end == room || *end != '\0' || target < 0 || target >= game->dungeon->roomCount)
     {
-        nextRoom = currentRoom->up;
+        sinkPrintf(&game->out, "There is no Room %s.\n", room);
+        return;
     }
-    else if (strcasecmp(direction, "down") == 0)
+    if (target == game->player.currentRoom)
     {
-        nextRoom = currentRoom->down;
+        sinkPrintf(&game->out, "You are already in Room %ld.\n", target);
+        return;
     }
-
-    // Check if the direction is valid
-    if (nextRoom == -1)
+    if (!game->router)
     {
-        printf("You can't go that way.\n");
+        sinkPrintf(&game->out, "You don't know the way.\n");
         return;
     }
 
-    // Check conditions for moving to Room 1 (Goblin's Hell) from Room 0
-    if (player->currentRoom == 0 && nextRoom == 1)
+    // Capabilities cannot change while walking, so every step is a lookup
+    // in the same route table. A shortest route visits no room twice; the
+    // walk stops if it gets longer than that or a step is refused, so a
+    // route table that disagrees with the rooms cannot hang the game.
+    for (int steps = 0; steps < game->dungeon->roomCount; steps++)
     {
-        if (!hasItemInInventory("Sword"))
-        {
-            printf("You cannot move to Goblin's Hell without a sword.\n");
+        int from = game->player.currentRoom;
+        int step = routerStep(game->router, game->capabilities, from, (int)target);
+        if (step == ROUTE_ARRIVED)
+            return;
+        if (step < 0)
+            break;
+        moveDirection(game, step);
+        if (game->player.currentRoom == from)
             return;
-        }
-        else
-        {
-            player->strength += 10;
-        }
     }
+    sinkPrintf(&game->out, "You can't find a way to Room %ld.\n", target);
+}
 
-    // Check conditions for moving to Room 3 (Treasure Room) from Room 1
-    if (player->currentRoom == 1 && nextRoom == 3)
+// Look command: display room description and items
+void look(GameState *game)
+{
+    const Player *player = &game->player;
+    int room = player->currentRoom;
+    const RoomView *view = roomViewFind(&game->views, room, game->capabilities);
+    if (view)
     {
-        if (!hasItemInInventory("Key"))
-        {
-            printf("You cannot move to the Treasure Room without the key.\n");
-            return;
-        }
+        sinkWrite(&game->out, view->text, view->length);
+        return;
     }
 
-    // Check conditions for moving to Room 2 (Witch's Alley) from Room 1
-    if (player->currentRoom == 1 && nextRoom == 2)
+    // Render into the sink and keep a copy of what was appended
+    OutputSink *out = &game->out;
+    size_t start = out->length;
+    const DungeonRoom *current = roomAt(game, room);
+    const char *creature = roomCreature(game, room);
+
+    // The dungeon's description variants say how the room changed
+    sinkPrintf(&game->out, "%s\n", dungeonDescription(game->dungeon, current, game->capabilities));
+    if (roomItemCount(game, room) > 0)
     {
-        if (!player->hasKilledGoblin)
+        sinkPrintf(&game->out, "Items: ");
+        for (int i = 0; i < dungeonRoomItemCount(current); i++)
         {
-            printf("You cannot move to Witch's Alley until you kill the goblin!\n");
-            return;
+            if (roomHasItem(game, room, i))
+                sinkPrintf(&game->out, "%s ", roomItemName(game, room, i));
         }
+        sinkPrintf(&game->out, "\n");
     }
-
-    if (player->currentRoom == 1 && nextRoom == 4)
+    if (creature)
     {
-        if (!hasItemInInventory("Armor"))
-        {
-            printf("You cannot move to the Final Boss room without equipping the armor!\n");
-            return;
-        }
+        sinkPrintf(&game->out, "Creature: %s (Health: %d)\n", creature, creatureHealth(game, room));
     }
+    if (out->kind != SINK_NULL)
+        roomViewStore(&game->views, room, game->capabilities, out->data + start, out->length - start);
+}
 
-    // Move the player to the next room
-    player->currentRoom = nextRoom;
-    printf("You move to Room %d.\n", player->currentRoom);
+// Map viewport, in rooms either side of the player
+#define MAP_RADIUS_X 7
+#define MAP_RADIUS_Y 4
+#define MAP_WIDTH (2 * MAP_RADIUS_X + 1)
+#define MAP_HEIGHT (2 * MAP_RADIUS_Y + 1)
+
+// Symbol of a room on the map
+static char mapSymbol(const GameState *game, int room)
+{
+    if (room == game->player.currentRoom)
+        return '@';
+    if (roomCreature(game, room))
+        return room == game->dungeon->header->goalRoom ? 'B' : 'c';
+    if (roomItemCount(game, room) > 0)
+        return 'i';
+    return ' ';
 }
 
-// Look command: display room description and items
-// Look command: display room description and itemsmove
-void look(const Player *player, const Room rooms[])
+// Symbol of the link leaving a room, ' ' if there is none
+static char mapLink(const GameState *game, int room, int direction, char open)
 {
-    Room current = rooms[player->currentRoom];
+    int next = roomAt(game, room)->exits[direction];
+    if (next < 0 || next >= game->dungeon->roomCount)
+        return ' ';
+    const DungeonGate *gate = dungeonExitGate(game->dungeon, room, direction);
+    if (gate && !((game->capabilities >> gate->requirement) & 1))
+        return '#';
+    return open;
+}
+
+// Draw the rooms around the player. The layout is found by walking the
+// up/down/left/right links breadth first from the current room and stops at
+// the edge of the viewport, so drawing costs the same in any size of world.
+// A room reached again at another position (in dungeons that are not a
+// grid) keeps the cell it was first placed in.
+void map(GameState *game)
+{
+    static const int stepX[DIR_COUNT] = {0, 0, -1, 1};
+    static const int stepY[DIR_COUNT] = {-1, 1, 0, 0};
+    int cells[MAP_HEIGHT][MAP_WIDTH];
+    int queue[MAP_HEIGHT * MAP_WIDTH];
+    int head = 0;
+    int tail = 0;
 
-    // Update Goblin's message after death
-    if (player->hasKilledGoblin && player->currentRoom == 1 && current.creature == NULL)
+    for (int y = 0; y < MAP_HEIGHT; y++)
     {
-        current.description = "You are in Goblins' Hell. The goblin's dead body lies on the ground.";
+        for (int x = 0; x < MAP_WIDTH; x++)
+            cells[y][x] = DUNGEON_NO_ROOM;
     }
-    else if (!player->hasKilledWitch && player->currentRoom == 2 && current.creature == NULL)
+    cells[MAP_RADIUS_Y][MAP_RADIUS_X] = game->player.currentRoom;
+    queue[tail++] = MAP_RADIUS_Y * MAP_WIDTH + MAP_RADIUS_X;
+
+    while (head < tail)
     {
-        current.description = "You are in Witch's Halley. Witch's ashes flying in the room.";
+        int cell = queue[head++];
+        int x = cell % MAP_WIDTH;
+        int y = cell / MAP_WIDTH;
+        const DungeonRoom *room = roomAt(game, cells[y][x]);
+        for (int d = 0; d < DIR_COUNT; d++)
+        {
+            int next = room->exits[d];
+            int nx = x + stepX[d];
+            int ny = y + stepY[d];
+            if (next < 0 || next >= game->dungeon->roomCount ||
+                nx < 0 || nx >= MAP_WIDTH || ny < 0 || ny >= MAP_HEIGHT || cells[ny][nx] != DUNGEON_NO_ROOM)
+                continue;
+            // At most one cell per room; the viewport is small enough to
+            // search the placed rooms directly.
+            int placed = 0;
+            for (int i = 0; i < tail && !placed; i++)
+                placed = cells[queue[i] / MAP_WIDTH][queue[i] % MAP_WIDTH] == next;
+            if (placed)
+                continue;
+            cells[ny][nx] = next;
+            queue[tail++] = ny * MAP_WIDTH + nx;
+        }
     }
-    else if (!player->hasKilledFinalBoss && player->currentRoom == 4 && current.creature == NULL)
+
+    // Only the rows and columns that hold rooms are drawn
+    int left = MAP_RADIUS_X, right = MAP_RADIUS_X, top = MAP_RADIUS_Y, bottom = MAP_RADIUS_Y;
+    for (int i = 1; i < tail; i++)
     {
-        current.description = "You are in Final Boss's room. His dead body lies on the ground. Who is BOSS now?!";
+        int x = queue[i] % MAP_WIDTH;
+        int y = queue[i] / MAP_WIDTH;
+        left = x < left ? x : left;
+        right = x > right ? x : right;
+        top = y < top ? y : top;
+        bottom = y > bottom ? y : bottom;
     }
 
-    printf("%s\n", current.description);
-    if (current.itemCount > 0)
+    // Every room is three characters wide followed by its right link, and
+    // every row of rooms is followed by a row of down links.
+    char line[MAP_WIDTH * 4 + 1];
+    for (int y = top; y <= bottom; y++)
     {
-        printf("Items: ");
-        for (int i = 0; i < current.itemCount; i++)
+        char *rooms = line;
+        for (int x = left; x <= right; x++)
         {
-            printf("%s ", current.items[i]);
+            int room = cells[y][x];
+            int linked = room != DUNGEON_NO_ROOM && x + 1 < MAP_WIDTH && cells[y][x + 1] != DUNGEON_NO_ROOM &&
+                         roomAt(game, room)->exits[DIR_RIGHT] == cells[y][x + 1];
+            *rooms++ = room == DUNGEON_NO_ROOM ? ' ' : '[';
+            *rooms++ = room == DUNGEON_NO_ROOM ? ' ' : mapSymbol(game, room);
+            *rooms++ = room == DUNGEON_NO_ROOM ? ' ' : ']';
+            *rooms++ = linked ? mapLink(game, room, DIR_RIGHT, '-') : ' ';
         }
-        printf("\n");
-    }
-    if (current.creature)
-    {
-        printf("Creature: %s (Health: %d)\n", current.creature, current.creatureHealth);
+        while (rooms > line && rooms[-1] == ' ')
+            rooms--;
+        *rooms = '\0';
+        sinkPrintf(&game->out, "%s\n", line);
+
+        if (y == bottom)
+            break;
+        char *links = line;
+        for (int x = left; x <= right; x++)
+        {
+            int room = cells[y][x];
+            int linked = room != DUNGEON_NO_ROOM && cells[y + 1][x] != DUNGEON_NO_ROOM &&
+                         roomAt(game, room)->exits[DIR_DOWN] == cells[y + 1][x];
+            *links++ = ' ';
+            *links++ = linked ? mapLink(game, room, DIR_DOWN, '|') : ' ';
+            *links++ = ' ';
+            *links++ = ' ';
+        }
+        while (links > line && links[-1] == ' ')
+            links--;
+        *links = '\0';
+        sinkPrintf(&game->out, "%s\n", line);
     }
-}
-
-void map()
-{
-  
-    printf("           -----------------\n");
-    printf("          | Witchs' Halley  |\n");
-    printf("           ------- && ------\n");
-    printf("          |                 |\n");
-    printf("----------     Goblins'     |-------------- \n");
-    printf(" Entrance &      Hell        &  FINAL BOSS  |\n");
-    printf("----------                  |--------------\n");
-    printf("          |                 |\n");
-    printf("           ------ && -------\n");
-    printf("          |       ???       |\n");
-    printf("           -----------------\n");
-  
+    sinkPrintf(&game->out, "@ you  c creature  B goal  i items  # locked\n");
 }
 
 // Inventory command: display items in the player's inventory
-void inventory(const Player *player)
+void inventory(GameState *game)
 {
-    printf("Inventory:\n");
-    for (int i = 0; i < player->inventoryCount; i++)
+    const Player *player = &game->player;
+    sinkPrintf(&game->out, "Inventory:\n");
+    for (ItemId id = itemSetNext(&player->inventory, 0); id != ITEM_NONE; id = itemSetNext(&player->inventory, id + 1))
     {
-        printf("- %s\n", player->inventory[i]);
+        sinkPrintf(&game->out, "- %s\n", itemName(id));
     }
 }
 
 // Pickup command: allow the player to pick up items
 
-void pickup(Player *player, Room *room, const char *itemName)
+void pickup(GameState *game, const char *name)
 {
-    for (int i = 0; i < room->itemCount; i++)
+    Player *player = &game->player;
+    int room = player->currentRoom;
+    ItemId item = itemFind(name);
+    for (int i = 0; item != ITEM_NONE && i < dungeonRoomItemCount(roomAt(game, room)); i++)
     {
-        if (strcasecmp(room->items[i], itemName) == 0)
+        if (roomHasItem(game, room, i) && roomItem(game, room, i) == item)
         {
-            if (player->inventoryCount < player->inventoryCapacity)
+            if (itemSetHas(&player->inventory, item))
             {
-                player->inventory[player->inventoryCount++] = strdup(room->items[i]);
-                printf("You picked up %s.\n", room->items[i]);
-
-                // Update Room 0 description after the item is picked up
-                if (player->currentRoom == 0)
-                {
-                    strcpy(room->description, "You are in the Dungeon Entrance. Let's go!"); // Updated pickup function with Room 0 description change
-                }
-
-                free(room->items[i]);
-                room->items[i] = room->items[room->itemCount - 1];
-                room->itemCount--;
+                sinkPrintf(&game->out, "You already carry the %s.\n", roomItemName(game, room, i));
+                return;
+            }
+            if (player->inventoryCount < player->inventoryCapacity && itemSetAdd(&player->inventory, item) == 0)
+            {
+                player->inventoryCount++;
+                game->capabilities = gameCapabilities(game);
+                sinkPrintf(&game->out, "You picked up %s.\n", roomItemName(game, room, i));
+
+                changeRoom(game, room)->itemsTaken |= 1ull << i;
                 return;
             }
             else
             {
-                printf("You can't carry more items!\n");
+                sinkPrintf(&game->out, "You can't carry more items!\n");
                 return;
             }
         }
     }
-    printf("Item not found.\n");
+    sinkPrintf(&game->out, "Item not found.\n");
 }
 
 
-// Attack command: simulate combat
-void attack(Player *player, Room *room)
+static const char *strikeWord(int count)
 {
-    if (!room->creature || room->creatureHealth <= 0)
+    return count == 1 ? "time" : "times";
+}
+
+// Attack command: the fight is resolved in closed form, then told either
+// blow by blow or, with fights brief, in one line
+int attack(GameState *game)
+{
+    Player *player = &game->player;
+    int room = player->currentRoom;
+    const char *creature = roomCreature(game, room);
+    if (!creature)
     {
-        printf("No creature to attack!\n");
-        return;
+        sinkPrintf(&game->out, "No creature to attack!\n");
+        return GAME_CONTINUE;
     }
 
     // Battle logic
-    while (player->health > 0 && room->creatureHealth > 0)
+    int startHealth = player->health;
+    int startCreature = creatureHealth(game, room);
+    CombatResult result = combatResolve(startHealth, player->strength, startCreature, CREATURE_DAMAGE);
+    int strikes = result.playerWon ? result.rounds - 1 : result.rounds;
+    if (game->briefFights)
     {
-        room->creatureHealth -= player->strength;
-        printf("You hit the %s. Its health is now %d.\n", room->creature, room->creatureHealth);
-
-        if (room->creatureHealth > 0)
+        sinkPrintf(&game->out, "You hit the %s %d %s and it hit you %d %s. Its health is now %d, yours %d.\n",
+                   creature, result.rounds, strikeWord(result.rounds), strikes, strikeWord(strikes),
+                   result.creatureHealth, result.playerHealth);
+    }
+    else
+    {
+        for (int round = 1; round <= result.rounds; round++)
         {
-            player->health -= 5;
-            printf("The %s hits you. Your health is now %d.\n", room->creature, player->health);
+            int health = startCreature - round * player->strength;
+            sinkPrintf(&game->out, "You hit the %s. Its health is now %d.\n", creature, health);
+            if (health > 0)
+                sinkPrintf(&game->out, "The %s hits you. Your health is now %d.\n", creature,
+                           startHealth - round * CREATURE_DAMAGE);
         }
     }
+    changeRoom(game, room)->creatureDamage += startCreature - result.creatureHealth;
+    player->health = result.playerHealth;
 
-    if (player->health <= 0)
+    if (result.playerWon)
     {
-        printf("You died. Game over!\n");
-        exit(0);
+        sinkPrintf(&game->out, "You defeated the %s!\n", creature);
+        game->capabilities = gameCapabilities(game);
+    }
+    else if (player->health <= 0)
+    {
+        sinkPrintf(&game->out, "You died. Game over!\n");
+        return GAME_OVER;
     }
     else
     {
-        printf("You defeated the %s!\n", room->creature);
-        free(room->creature);
-        room->creature = NULL;
-
-        
-
-        // Mark goblin as killed
-        player->hasKilledGoblin = 1;
+        sinkPrintf(&game->out, "Neither you nor the %s can hurt the other.\n", creature);
     }
+    return GAME_CONTINUE;
 }
 
 // Function to convert string to lowercase
@@ -467,94 +642,234 @@ void toLowerCase(char *str)
     }
 }
 
-// Handle commands from the player
-void handleCommand(Player *player, Room rooms[], char *command)
+static int runSave(GameState *game, char *filepath)
 {
-    if (strncmp(command, "save ", 5) == 0)
-    {
-        // Save game
-        char *filepath = command + 5;
-        save(filepath);
-    }
-    else if (strncmp(command, "load ", 5) == 0)
-    {
-        // Load game
-        char *filepath = command + 5;
-        load(filepath);  // Load from the specified file
-    }
-    else if (strcasecmp(command, "quit") == 0)
-    {
-        printf("Thank you for playing. Goodbye!\n");
-        exit(0);
-    }
-    else if (strcasecmp(command, "help") == 0)
-    {
-        printf("Available commands:\n");
-        printf("  move <direction>  - Move in a direction (up, down, left, right).\n");
-        printf("  look              - Look around the room.\n");
-        printf("  map               - Shows map\n");
-        printf("  inventory         - View your inventory.\n");
-        printf("  pickup <item>    - Pick up an item in the room.\n");
-        printf("  attack            - Attack a creature in the room.\n");
-        printf("  save <filepath>   - Save the game state to a file.\n");
-        printf("  load <filepath>   - Load the game state from a file.\n");
-        printf("  quit              - Quit the game.\n");
-    }
-    else if (strncmp(command, "move ", 5) == 0)
-    {
-        move(player, rooms, command + 5);
-    }
-    else if (strcasecmp(command, "look") == 0)
-    {
-        look(player, rooms);
-    }
-    else if (strcasecmp(command, "inventory") == 0)
-    {
-        inventory(player);
-    }
-    else if (strncmp(command, "pickup ", 7) == 0)
-    {
-        pickup(player, &rooms[player->currentRoom], command + 7);
-    }
-    else if (strcasecmp(command, "attack") == 0)
-    {
-        attack(player, &rooms[player->currentRoom]);
-    }else if (strcasecmp(command, "map") == 0)
+    save(game, filepath);
+    return GAME_CONTINUE;
+}
+
+static int runBackgroundSave(GameState *game, char *filepath)
+{
+    backgroundSave(game, filepath);
+    return GAME_CONTINUE;
+}
+
+static int runLoad(GameState *game, char *filepath)
+{
+    load(game, filepath); // Load from the specified file
+    return GAME_CONTINUE;
+}
+
+static int runExport(GameState *game, char *filepath)
+{
+    // Export a readable text dump of the game
+    exportText(game, filepath);
+    return GAME_CONTINUE;
+}
+
+static int runQuit(GameState *game, char *argument)
+{
+    (void)argument;
+    sinkPrintf(&game->out, "Thank you for playing. Goodbye!\n");
+    return GAME_QUIT;
+}
+
+static int runHelp(GameState *game, char *argument)
+{
+    (void)argument;
+    sinkPrintf(&game->out, "Available commands:\n");
+    sinkPrintf(&game->out, "  move <direction>  - Move in a direction (up, down, left, right).\n");
+    sinkPrintf(&game->out, "  goto <room>       - Walk the shortest open way to a room.\n");
+    sinkPrintf(&game->out, "  look              - Look around the room.\n");
+    sinkPrintf(&game->out, "  map               - Shows map\n");
+    sinkPrintf(&game->out, "  inventory         - View your inventory.\n");
+    sinkPrintf(&game->out, "  pickup <item>    - Pick up an item in the room.\n");
+    sinkPrintf(&game->out, "  attack            - Attack a creature in the room.\n");
+    sinkPrintf(&game->out, "  save <filepath>   - Save the game state to a file.\n");
+    sinkPrintf(&game->out, "  bgsave <filepath> - Save in the background and keep playing.\n");
+    sinkPrintf(&game->out, "  load <filepath>   - Load the game state from a file.\n");
+    sinkPrintf(&game->out, "  export <filepath> - Write the game state as readable text.\n");
+    sinkPrintf(&game->out, "  fights brief|full - Tell fights in one line or blow by blow.\n");
+    sinkPrintf(&game->out, "  stats             - Show command latencies and allocations.\n");
+    sinkPrintf(&game->out, "  quit              - Quit the game.\n");
+    sinkPrintf(&game->out, "Also: go/walk (move), travel (goto), l (look), m (map), i/inv (inventory),\n");
+    sinkPrintf(&game->out, "get/take (pickup), fight/kill (attack), ? (help), exit/q (quit).\n");
+    return GAME_CONTINUE;
+}
+
+static int runMove(GameState *game, char *direction)
+{
+    move(game, direction);
+    return GAME_CONTINUE;
+}
+
+static int runGoto(GameState *game, char *room)
+{
+    travel(game, room);
+    return GAME_CONTINUE;
+}
+
+static int runLook(GameState *game, char *argument)
+{
+    (void)argument;
+    look(game);
+    return GAME_CONTINUE;
+}
+
+static int runInventory(GameState *game, char *argument)
+{
+    (void)argument;
+    inventory(game);
+    return GAME_CONTINUE;
+}
+
+static int runPickup(GameState *game, char *item)
+{
+    pickup(game, item);
+    return GAME_CONTINUE;
+}
+
+static int runAttack(GameState *game, char *argument)
+{
+    (void)argument;
+    return attack(game);
+}
+
+static int runFights(GameState *game, char *mode)
+{
+    if (strcmp(mode, "brief") == 0 || strcmp(mode, "full") == 0)
     {
-        map();
+        game->briefFights = strcmp(mode, "brief") == 0;
+        sinkPrintf(&game->out, "Fights are now told in %s.\n", game->briefFights ? "one line" : "full");
     }
     else
-    {
-        printf("Unknown command. Type 'help' for a list of commands.\n");
-    }
+        sinkPrintf(&game->out, "Fights can be brief or full.\n");
+    return GAME_CONTINUE;
 }
 
+static int runMap(GameState *game, char *argument)
+{
+    (void)argument;
+    map(game);
+    return GAME_CONTINUE;
+}
 
-int main()
+static int runStats(GameState *game, char *argument)
 {
-    char command[MAX_INPUT_SIZE];
+    (void)argument;
+#ifdef GAME_STATS
+    statsPrint(&game->out);
+#else
+    sinkPrintf(&game->out, "Statistics are not compiled in; build with -DGAME_STATS.\n");
+#endif
+    return GAME_CONTINUE;
+}
 
-    // Initialize game
-    initializeGame();
-    
+// Handler of every command kind, indexed by kind
+static int (*const runners[CMD_KIND_COUNT])(GameState *game, char *argument) = {
+    [CMD_MOVE] = runMove,
+    [CMD_GOTO] = runGoto,
+    [CMD_LOOK] = runLook,
+    [CMD_MAP] = runMap,
+    [CMD_INVENTORY] = runInventory,
+    [CMD_PICKUP] = runPickup,
+    [CMD_ATTACK] = runAttack,
+    [CMD_SAVE] = runSave,
+    [CMD_BGSAVE] = runBackgroundSave,
+    [CMD_LOAD] = runLoad,
+    [CMD_EXPORT] = runExport,
+    [CMD_HELP] = runHelp,
+    [CMD_FIGHTS] = runFights,
+    [CMD_STATS] = runStats,
+    [CMD_QUIT] = runQuit,
+};
+
+int runCommand(GameState *game, const ParsedCommand *command)
+{
+    reportBackgroundSave(game);
+    STATS_BEGIN(command->kind);
+    int status = GAME_CONTINUE;
+    if (command->kind == CMD_UNKNOWN)
+        sinkPrintf(&game->out, "Unknown command. Type 'help' for a list of commands.\n");
+    else if ((command->flags & COMMAND_ARGUMENT) && !command->argument)
+        sinkPrintf(&game->out, "Usage: %s <%s>\n", commandKindName(command->kind),
+                   commandArgumentName(command->kind));
+    else
+        status = runners[command->kind](game, command->argument);
+    STATS_END();
+    return status;
+}
+
+// Handle commands from the player
+int handleCommand(GameState *game, char *command)
+{
+    ParsedCommand parsed;
+    parseCommand(command, &parsed);
+    return runCommand(game, &parsed);
+}
 
-    while (1)
+// FNV-1a hash of the whole game state, used to compare replays
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < size; i++)
     {
-        printf("\n> ");
-        if (fgets(command, MAX_INPUT_SIZE, stdin) != NULL)
-        {
-            // Remove trailing newline character
-            command[strcspn(command, "\n")] = '\0';
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
 
-            // Convert input to lowercase for consistency
-            toLowerCase(command);
+uint64_t gameStateHash(const GameState *game)
+{
+    const Player *player = &game->player;
+    int32_t fields[] = {player->health, player->strength, player->inventoryCapacity,
+                        player->inventoryCount, player->currentRoom};
+    uint64_t hash = hashBytes(14695981039346656037ull, fields, sizeof(fields));
+    for (ItemId id = itemSetNext(&player->inventory, 0); id != ITEM_NONE; id = itemSetNext(&player->inventory, id + 1))
+    {
+        int32_t item = id;
+        hash = hashBytes(hash, &item, sizeof(item));
+    }
 
-            handleCommand(&player, rooms, command);
-        }
+    // Room states are summed so the table's slot order does not matter
+    uint64_t rooms = 0;
+    for (uint32_t i = 0; i < game->rooms.capacity; i++)
+    {
+        const RoomState *state = &game->rooms.states[i];
+        if (game->rooms.keys[i] == 0 || (state->creatureDamage == 0 && state->itemsTaken == 0))
+            continue;
+        int32_t room = roomTableRoom(&game->rooms, i);
+        uint64_t entry = hashBytes(14695981039346656037ull, &room, sizeof(room));
+        entry = hashBytes(entry, &state->creatureDamage, sizeof(state->creatureDamage));
+        rooms += hashBytes(entry, &state->itemsTaken, sizeof(state->itemsTaken));
     }
+    return hashBytes(hash, &rooms, sizeof(rooms));
+}
 
-    // Free allocated resources
-    freeResources();
+uint64_t gameCapabilities(const GameState *game)
+{
+    const Dungeon *dungeon = game->dungeon;
+    uint64_t capabilities = 0;
+    for (int i = 0; i < dungeon->requirementCount; i++)
+    {
+        const DungeonRequirement *requirement = &dungeon->requirements[i];
+        int met = 0;
+        if (requirement->kind == REQUIRE_ITEM && requirement->value < (uint32_t)dungeon->itemCount)
+            met = itemSetHas(&game->player.inventory, dungeon->itemIds[requirement->value]);
+        else if (requirement->kind == REQUIRE_KILL && requirement->value < (uint32_t)dungeon->roomCount)
+            met = roomAt(game, (int)requirement->value)->creature != 0 &&
+                  creatureHealth(game, (int)requirement->value) <= 0;
+        capabilities |= (uint64_t)met << i;
+    }
+    return capabilities;
+}
 
-    return 0;
+size_t gameBytesUsed(const GameState *game)
+{
+    const ItemSet *inventory = &game->player.inventory;
+    size_t bytes = arenaBytesReserved(&game->arena) + game->out.capacity;
+    if (inventory->wordCount > ITEM_SET_INLINE_WORDS)
+        bytes += sizeof(uint64_t) * (size_t)inventory->wordCount;
+    return bytes;
 }
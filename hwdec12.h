@@ -1,86 +1,168 @@
 #ifndef HWDEC12_H
 #define HWDEC12_H
 
+#include "arena.h"
+#include "bgsave.h"
+#include "command.h"
+#include "dungeon.h"
+#include "items.h"
+#include "output.h"
+#include "roomstate.h"
+#include "roomview.h"
+#include "route.h"
+
+// A new player's starting stats
+#define PLAYER_HEALTH 100
+#define PLAYER_STRENGTH 15
+#define INVENTORY_CAPACITY 5
+
 // Structures
-typedef struct Room
-{
-    char *description;
-    int up, down, left, right; // Room connections
-    char **items;              // Items in the room
-    int itemCount;
-    char *creature;     // Creature name
-    int creatureHealth; // Creature health
-} Room;
 
 typedef struct Player
 {
     int health;
     int strength;
     int inventoryCapacity;
-    char **inventory;
+    ItemSet inventory; // Items carried, by item id
     int inventoryCount;
     int currentRoom;
-    int hasVisitedTreasureRoom; // Flag to track if the player has visited the Treasure Room
-    int hasKilledGoblin;        // Flag to track if the player has killed the goblin
-    int hasArmor;
-    int hasKilledWitch;
-    int hasKilledFinalBoss;
 } Player;
 
+// The file the session saved to last. Saving there again only appends what
+// changed since (see snapshot.h).
+typedef struct SaveFile
+{
+    char *path;         // NULL until the first save
+    uint64_t size;      // Size of the file as the last save left it
+    uint64_t baseSize;  // Its full snapshot, without the deltas
+    uint64_t playerSum; // Checksums of the player and inventory last saved
+    int deltas;         // Deltas appended since the full snapshot
+} SaveFile;
+
+#define SESSION_ARENA_BLOCK 4096 // Arena block size of a game session
+
+// Everything one game session needs. The dungeon is shared read-only
+// between sessions; the player, room states and output belong to the
+// session, so one process can host any number of games. The session's
+// mutable world state is allocated from its own arena, so starting over
+// or ending a session is a few frees however much of the world it touched.
+typedef struct GameState
+{
+    const Dungeon *dungeon;
+    Player player;
+    Arena arena;     // Holds the room table
+    RoomTable rooms; // State of the rooms this session changed
+    RoomViews views; // Look output of recently seen rooms, in the arena
+    OutputSink out;  // Where the session's output goes
+    uint64_t capabilities; // Requirements met, updated on pickups and kills
+    Router *router;  // Route cache shared by the dungeon's sessions, set by the host
+    BackgroundSave background; // Save running in a child process, if any
+    SaveFile saved;  // Where the last save went
+    int briefFights; // Tell fights in one line, kept in snapshots too
+} GameState;
+
+// Result of handling a command
+enum GameStatus
+{
+    GAME_CONTINUE, // Keep reading commands
+    GAME_QUIT,     // The player quit
+    GAME_OVER      // The player died
+};
+
 // Function Prototypes
 
-void initializeGame();
-void freeResources();
-void loadRooms();
-void save(const char *filepath);
-void load(const char *filepath);
-void move(Player *player, Room rooms[], const char *direction);
-void look(const Player *player, const Room rooms[]);
-void inventory(const Player *player);
-void pickup(Player *player, Room *room, const char *itemName);
-void attack(Player *player, Room *room);
-void handleCommand(Player *player, Room rooms[], char *command);
+int initializeGame(GameState *game, const Dungeon *dungeon);
+int newGame(GameState *game, const Dungeon *dungeon);
+void freeResources(GameState *game);
+int loadRooms(Dungeon *dungeon, const char *dungeonPath);
+void save(GameState *game, const char *filepath);
+void backgroundSave(GameState *game, const char *filepath);
+void load(GameState *game, const char *filepath);
+void exportText(GameState *game, const char *filepath);
+void move(GameState *game, const char *direction);
+void travel(GameState *game, const char *room);
+void look(GameState *game);
+void inventory(GameState *game);
+void pickup(GameState *game, const char *itemName);
+int attack(GameState *game);
+int handleCommand(GameState *game, char *command);
 void toLowerCase(char *str);
-void map();
-int hasItemInInventory(const char *item);
+void map(GameState *game);
+int hasItemInInventory(const Player *player, const char *item);
+uint64_t gameStateHash(const GameState *game);
+size_t gameBytesUsed(const GameState *game);
+uint64_t gameCapabilities(const GameState *game);
+
+// Initialize Game Data and print the welcome message
+int initializeGame(GameState *game, const Dungeon *dungeon);
+
+// Start a new game in a loaded dungeon: reset the player and every room.
+// The session's output sink is left as it is.
+int newGame(GameState *game, const Dungeon *dungeon);
 
-// Initialize Game Data
-void initializeGame();
+// Open the dungeon file, paging rooms in as the game uses them. The path
+// BUILTIN_DUNGEON opens the dungeon compiled into the program instead.
+int loadRooms(Dungeon *dungeon, const char *dungeonPath);
 
-// Load Rooms Data
-void loadRooms();
+// Free allocated resources of a session
+void freeResources(GameState *game);
 
-// Free allocated resources
-void freeResources();
+// Save game state to a binary snapshot file
+void save(GameState *game, const char *filepath);
 
-// Save game state to a file
-void save(const char *filepath);
+// Load game state from a snapshot file
+void load(GameState *game, const char *filepath);
+
+// Write the game state to a file as readable text
+void exportText(GameState *game, const char *filepath);
 
 // Move the player in a specified direction
-void move(Player *player, Room rooms[], const char *direction);
+void move(GameState *game, const char *direction);
+
+// Walk the shortest open route to a room (the goto command)
+void travel(GameState *game, const char *room);
 
 // Look around in the current room
-void look(const Player *player, const Room rooms[]);
+void look(GameState *game);
 
 // Show the player's inventory
-void inventory(const Player *player);
+void inventory(GameState *game);
 
 // Pick up an item in the current room
-void pickup(Player *player, Room *room, const char *itemName);
+void pickup(GameState *game, const char *itemName);
+
+// Attack a creature in the current room, returns GAME_OVER if the player
+// dies. The fight is resolved in constant time however long it lasts.
+int attack(GameState *game);
+
+// Save in a forked child so the game does not wait for the snapshot to be
+// written. The outcome is reported before the output of a later command.
+void backgroundSave(GameState *game, const char *filepath);
 
-// Attack a creature in the room
-void attack(Player *player, Room *room);
+// Handle a line entered by the player, returns a GameStatus. The line is
+// parsed in place.
+int handleCommand(GameState *game, char *command);
 
-// Handle commands entered by the player
-void handleCommand(Player *player, Room rooms[], char *command);
+// Run a command parsed with parseCommand, returns a GameStatus
+int runCommand(GameState *game, const ParsedCommand *command);
 
 // Convert a string to lowercase
 void toLowerCase(char *str);
 
-// Display a simple map of the game
-void map();
+// Draw the rooms around the player, linked by their exits
+void map(GameState *game);
 
 // Check if the player has a specific item in their inventory
-int hasItemInInventory(const char *item);
+int hasItemInInventory(const Player *player, const char *item);
+
+// Hash of the complete game state, equal states hash equal
+uint64_t gameStateHash(const GameState *game);
+
+// Memory held by a session: its arena, inventory and output buffer
+size_t gameBytesUsed(const GameState *game);
+
+// Requirements of gates and variants the player meets, as a mask of
+// capability bits
+uint64_t gameCapabilities(const GameState *game);
 
 #endif // GAME_H
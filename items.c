@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "arena.h"
+#include "items.h"
+#include "stats.h"
+
+#define ITEM_TABLE_INITIAL_SIZE 64
+#define ITEM_NAME_BLOCK 4096
+
+typedef struct ItemTable
+{
+    char **names;     // By id
+    int count;
+    int capacity;
+    ItemId *buckets;  // Open addressing over ids, ITEM_NONE when empty
+    int bucketCount;  // Power of two
+    Arena strings;    // Name strings, kept for the life of the process
+} ItemTable;
+
+static ItemTable table;
+
+static uint32_t hashName(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++)
+    {
+        hash ^= (unsigned char)tolower((unsigned char)*name);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int sameName(const char *a, const char *b)
+{
+    for (; *a && *b; a++, b++)
+    {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b))
+            return 0;
+    }
+    return *a == *b;
+}
+
+static int findBucket(const char *name)
+{
+    int mask = table.bucketCount - 1;
+    int bucket = (int)(hashName(name) & (uint32_t)mask);
+    while (table.buckets[bucket] != ITEM_NONE && !sameName(table.names[table.buckets[bucket]], name))
+        bucket = (bucket + 1) & mask;
+    return bucket;
+}
+
+static int rehash(int bucketCount)
+{
+    ItemId *buckets = statsMalloc(sizeof(ItemId) * (size_t)bucketCount);
+    if (!buckets)
+        return -1;
+    free(table.buckets);
+    table.buckets = buckets;
+    table.bucketCount = bucketCount;
+    for (int i = 0; i < bucketCount; i++)
+        table.buckets[i] = ITEM_NONE;
+    for (ItemId id = 0; id < table.count; id++)
+        table.buckets[findBucket(table.names[id])] = id;
+    return 0;
+}
+
+ItemId itemFind(const char *name)
+{
+    if (table.bucketCount == 0)
+        return ITEM_NONE;
+    return table.buckets[findBucket(name)];
+}
+
+ItemId itemIntern(const char *name)
+{
+    ItemId id = itemFind(name);
+    if (id != ITEM_NONE)
+        return id;
+
+    if ((table.count + 1) * 2 > table.bucketCount &&
+        rehash(table.bucketCount ? table.bucketCount * 2 : ITEM_TABLE_INITIAL_SIZE) != 0)
+        return ITEM_NONE;
+    if (table.count == table.capacity)
+    {
+        int capacity = table.capacity ? table.capacity * 2 : ITEM_TABLE_INITIAL_SIZE;
+        char **names = statsRealloc(table.names, sizeof(char *) * (size_t)capacity);
+        if (!names)
+            return ITEM_NONE;
+        table.names = names;
+        table.capacity = capacity;
+    }
+
+    if (table.strings.blockSize == 0)
+        arenaInit(&table.strings, ITEM_NAME_BLOCK);
+    size_t length = strlen(name) + 1;
+    char *copy = arenaAlloc(&table.strings, length);
+    if (!copy)
+        return ITEM_NONE;
+    memcpy(copy, name, length);
+
+    id = table.count++;
+    table.names[id] = copy;
+    table.buckets[findBucket(name)] = id;
+    return id;
+}
+
+const char *itemName(ItemId item)
+{
+    if (item < 0 || item >= table.count)
+        return "";
+    return table.names[item];
+}
+
+int itemCount()
+{
+    return table.count;
+}
+
+static uint64_t *setWords(ItemSet *set)
+{
+    return set->wordCount > ITEM_SET_INLINE_WORDS ? set->words : set->inlineWords;
+}
+
+static const uint64_t *constSetWords(const ItemSet *set)
+{
+    return set->wordCount > ITEM_SET_INLINE_WORDS ? set->words : set->inlineWords;
+}
+
+int itemSetInit(ItemSet *set, int capacity)
+{
+    memset(set, 0, sizeof(*set));
+    int words = (capacity + 63) / 64;
+    if (words <= ITEM_SET_INLINE_WORDS)
+    {
+        set->wordCount = ITEM_SET_INLINE_WORDS;
+        return 0;
+    }
+    set->words = statsCalloc((size_t)words, sizeof(uint64_t));
+    if (!set->words)
+        return -1;
+    set->wordCount = words;
+    return 0;
+}
+
+void itemSetFree(ItemSet *set)
+{
+    if (set->wordCount > ITEM_SET_INLINE_WORDS)
+        free(set->words);
+    memset(set, 0, sizeof(*set));
+}
+
+void itemSetClear(ItemSet *set)
+{
+    memset(setWords(set), 0, sizeof(uint64_t) * (size_t)set->wordCount);
+}
+
+int itemSetHas(const ItemSet *set, ItemId item)
+{
+    if (item < 0 || item / 64 >= set->wordCount)
+        return 0;
+    return (constSetWords(set)[item / 64] >> (item % 64)) & 1;
+}
+
+int itemSetAdd(ItemSet *set, ItemId item)
+{
+    if (item < 0)
+        return -1;
+    if (item / 64 >= set->wordCount)
+    {
+        // Only happens for items interned after the set was created
+        int words = item / 64 + 1;
+        uint64_t *grown = statsCalloc((size_t)words, sizeof(uint64_t));
+        if (!grown)
+            return -1;
+        memcpy(grown, setWords(set), sizeof(uint64_t) * (size_t)set->wordCount);
+        if (set->wordCount > ITEM_SET_INLINE_WORDS)
+            free(set->words);
+        set->words = grown;
+        set->wordCount = words;
+    }
+    setWords(set)[item / 64] |= 1ull << (item % 64);
+    return 0;
+}
+
+void itemSetRemove(ItemSet *set, ItemId item)
+{
+    if (item >= 0 && item / 64 < set->wordCount)
+        setWords(set)[item / 64] &= ~(1ull << (item % 64));
+}
+
+ItemId itemSetNext(const ItemSet *set, ItemId from)
+{
+    if (from < 0)
+        from = 0;
+    const uint64_t *words = constSetWords(set);
+    int word = from / 64;
+    if (word >= set->wordCount)
+        return ITEM_NONE;
+    uint64_t bits = words[word] & (~0ull << (from % 64));
+    for (;;)
+    {
+        if (bits)
+            return word * 64 + __builtin_ctzll(bits);
+        if (++word >= set->wordCount)
+            return ITEM_NONE;
+        bits = words[word];
+    }
+}
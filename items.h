@@ -0,0 +1,52 @@
+#ifndef ITEMS_H
+#define ITEMS_H
+
+#include <stdint.h>
+
+// Process-wide item symbol table. Every item name is interned once to a
+// small integer ItemId; the game compares and stores items by id only.
+// Names are matched case-insensitively and keep the spelling they were
+// first interned with. Interning is not thread-safe: it happens while
+// dungeons are loaded, lookups can run concurrently afterwards.
+
+typedef int ItemId;
+
+#define ITEM_NONE -1
+
+// Id of an item, adding it to the table if it is new
+ItemId itemIntern(const char *name);
+
+// Id of an item, ITEM_NONE if the name was never interned
+ItemId itemFind(const char *name);
+
+// Name of an item id
+const char *itemName(ItemId item);
+
+// Number of interned items, ids run from 0 to itemCount() - 1
+int itemCount();
+
+// Set of items as a bitset, used for the player's inventory. Sets of up to
+// ITEM_SET_INLINE_WORDS * 64 items need no allocation at all.
+#define ITEM_SET_INLINE_WORDS 2
+
+typedef struct ItemSet
+{
+    int wordCount;
+    uint64_t *words; // Only used when wordCount > ITEM_SET_INLINE_WORDS
+    uint64_t inlineWords[ITEM_SET_INLINE_WORDS];
+} ItemSet;
+
+// Prepare an empty set able to hold ids below capacity without growing
+int itemSetInit(ItemSet *set, int capacity);
+void itemSetFree(ItemSet *set);
+void itemSetClear(ItemSet *set);
+
+int itemSetHas(const ItemSet *set, ItemId item);
+int itemSetAdd(ItemSet *set, ItemId item); // Returns -1 if memory runs out
+void itemSetRemove(ItemSet *set, ItemId item);
+
+// First item in the set at or after from, ITEM_NONE when there is none.
+// Iterate with: for (id = itemSetNext(s, 0); id != ITEM_NONE; id = itemSetNext(s, id + 1))
+ItemId itemSetNext(const ItemSet *set, ItemId from);
+
+#endif // ITEMS_H
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "journal.h"
+#include "snapshot.h"
+#include "stats.h"
+
+#define MAX_COMMAND_RECORD 4096
+
+static int writeAll(int fd, const void *data, size_t size)
+{
+    const char *p = data;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+// Make a rename in the journal's directory durable
+static void syncDirectory(const char *path)
+{
+    char *copy = statsStrdup(path);
+    if (!copy)
+        return;
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+    free(copy);
+}
+
+int journalCheckpoint(Journal *journal, const GameState *game)
+{
+    unsigned char *snapshot;
+    size_t snapshotSize;
+    if (snapshotEncode(game, &snapshot, &snapshotSize) != 0 || snapshotSize > UINT32_MAX)
+        return -1;
+
+    // Header, record and snapshot go out in one write
+    size_t size = sizeof(JournalHeader) + sizeof(JournalRecord) + snapshotSize;
+    unsigned char *buffer = statsMalloc(size);
+    size_t pathLength = strlen(journal->path);
+    char *temporary = statsMalloc(pathLength + 5);
+    if (!buffer || !temporary)
+    {
+        free(snapshot);
+        free(buffer);
+        free(temporary);
+        return -1;
+    }
+
+    JournalHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = JOURNAL_MAGIC;
+    header.version = JOURNAL_VERSION;
+    header.dungeonId = snapshotDungeonId(game->dungeon);
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = JOURNAL_CHECKPOINT;
+    record.length = (uint32_t)snapshotSize;
+    record.crc = checksum32(snapshot, snapshotSize);
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), &record, sizeof(record));
+    memcpy(buffer + sizeof(header) + sizeof(record), snapshot, snapshotSize);
+    free(snapshot);
+
+    memcpy(temporary, journal->path, pathLength);
+    memcpy(temporary + pathLength, ".tmp", 5);
+    int result = -1;
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd >= 0)
+    {
+        if (writeAll(fd, buffer, size) == 0 && fdatasync(fd) == 0 && rename(temporary, journal->path) == 0)
+        {
+            syncDirectory(journal->path);
+            if (journal->fd >= 0)
+                close(journal->fd);
+            journal->fd = fd;
+            journal->records = 0;
+            journal->dirty = 0;
+            result = 0;
+        }
+        else
+        {
+            close(fd);
+            unlink(temporary);
+        }
+    }
+
+    free(temporary);
+    free(buffer);
+    return result;
+}
+
+// Read a whole journal file, NULL if it does not exist
+static unsigned char *readJournal(int fd, size_t *size)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return NULL;
+    unsigned char *buffer = statsMalloc((size_t)st.st_size + 1);
+    if (!buffer)
+        return NULL;
+    size_t got = 0;
+    ssize_t n;
+    while (got < (size_t)st.st_size && (n = read(fd, buffer + got, (size_t)st.st_size - got)) > 0)
+        got += (size_t)n;
+    *size = got;
+    return buffer;
+}
+
+long journalOpen(Journal *journal, const char *path, GameState *game)
+{
+    memset(journal, 0, sizeof(*journal));
+    journal->fd = -1;
+    journal->path = statsStrdup(path);
+    if (!journal->path)
+        return -1;
+
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        // A new journal starts with a checkpoint of the game as it is
+        if (journalCheckpoint(journal, game) != 0)
+        {
+            fprintf(stderr, "Error creating journal %s.\n", path);
+            journalClose(journal);
+            return -1;
+        }
+        return 0;
+    }
+
+    size_t size = 0;
+    unsigned char *buffer = readJournal(fd, &size);
+    JournalHeader header;
+    if (!buffer || size < sizeof(header))
+    {
+        fprintf(stderr, "Error reading journal %s.\n", path);
+        free(buffer);
+        close(fd);
+        journalClose(journal);
+        return -1;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    if (header.magic != JOURNAL_MAGIC || header.version != JOURNAL_VERSION ||
+        header.dungeonId != snapshotDungeonId(game->dungeon))
+    {
+        fprintf(stderr, "%s is not a journal for this dungeon.\n", path);
+        free(buffer);
+        close(fd);
+        journalClose(journal);
+        return -1;
+    }
+
+    // Replay without output; the session's own sink is put back afterwards
+    OutputSink out = game->out;
+    sinkInit(&game->out, SINK_NULL, -1);
+
+    long replayed = 0;
+    int status = GAME_CONTINUE;
+    int broken = 0;
+    size_t offset = sizeof(header);
+    char command[MAX_COMMAND_RECORD + 1];
+    while (size - offset >= sizeof(JournalRecord))
+    {
+        JournalRecord record;
+        memcpy(&record, buffer + offset, sizeof(record));
+        const unsigned char *payload = buffer + offset + sizeof(record);
+        if (record.length > size - offset - sizeof(record) || checksum32(payload, record.length) != record.crc)
+            break; // Torn or damaged tail
+
+        if (record.type == JOURNAL_CHECKPOINT)
+        {
+            if (snapshotDecode(game, payload, record.length) != 0)
+            {
+                broken = 1;
+                break;
+            }
+            journal->records = 0;
+        }
+        else if (record.type == JOURNAL_COMMAND && record.length <= MAX_COMMAND_RECORD)
+        {
+            memcpy(command, payload, record.length);
+            command[record.length] = '\0';
+            if (status == GAME_CONTINUE)
+                status = handleCommand(game, command);
+            journal->records++;
+            replayed++;
+        }
+        offset += sizeof(record) + record.length;
+    }
+    sinkFree(&game->out);
+    game->out = out;
+    free(buffer);
+    game->capabilities = gameCapabilities(game);
+
+    if (broken)
+    {
+        fprintf(stderr, "Journal %s has a damaged checkpoint.\n", path);
+        close(fd);
+        journalClose(journal);
+        return -1;
+    }
+
+    // Cut off a torn tail so new records follow the last good one
+    if (offset < size && ftruncate(fd, (off_t)offset) != 0)
+    {
+        close(fd);
+        journalClose(journal);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_END);
+    journal->fd = fd;
+
+    // A game that ended in death is not resumed
+    if (status == GAME_OVER && newGame(game, game->dungeon) != 0)
+    {
+        journalClose(journal);
+        return -1;
+    }
+    if ((status == GAME_OVER || journalCheckpointDue(journal)) && journalCheckpoint(journal, game) != 0)
+    {
+        fprintf(stderr, "Error writing journal %s.\n", path);
+        journalClose(journal);
+        return -1;
+    }
+    return replayed;
+}
+
+int journalAppend(Journal *journal, const char *command)
+{
+    size_t length = strlen(command);
+    if (length > MAX_COMMAND_RECORD)
+        return -1;
+
+    unsigned char buffer[sizeof(JournalRecord) + MAX_COMMAND_RECORD];
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = JOURNAL_COMMAND;
+    record.length = (uint32_t)length;
+    record.crc = checksum32(command, length);
+    memcpy(buffer, &record, sizeof(record));
+    memcpy(buffer + sizeof(record), command, length);
+    if (writeAll(journal->fd, buffer, sizeof(record) + length) != 0)
+        return -1;
+    journal->records++;
+    journal->dirty = 1;
+    return 0;
+}
+
+int journalCommit(Journal *journal)
+{
+    if (!journal->dirty)
+        return 0;
+    if (fdatasync(journal->fd) != 0)
+        return -1;
+    journal->dirty = 0;
+    return 0;
+}
+
+int journalCommitGroup(Journal **journals, int count)
+{
+    if (count == 1)
+        return journalCommit(journals[0]);
+    if (count == 0 || syncfs(journals[0]->fd) != 0)
+        return count == 0 ? 0 : -1;
+    for (int i = 0; i < count; i++)
+        journals[i]->dirty = 0;
+    return 0;
+}
+
+int journalCheckpointDue(const Journal *journal)
+{
+    return journal->records >= JOURNAL_CHECKPOINT_INTERVAL;
+}
+
+// Journal a command under its own name, whatever alias was typed
+static int appendCommand(Journal *journal, const ParsedCommand *command)
+{
+    char text[MAX_COMMAND_RECORD + 1];
+    const char *name = commandKindName(command->kind);
+    int length = command->argument ? snprintf(text, sizeof(text), "%s %s", name, command->argument)
+                                   : snprintf(text, sizeof(text), "%s", name);
+    if (length < 0 || length > MAX_COMMAND_RECORD)
+        return -1;
+    return journalAppend(journal, text);
+}
+
+int journalRun(Journal *journal, GameState *game, const ParsedCommand *command)
+{
+    // save and export write files, which a replay must not do again
+    int journaled = commandChangesGame(command);
+    if (journaled && appendCommand(journal, command) != 0)
+        sinkPrintf(&game->out, "Warning: the command could not be journaled.\n");
+
+    int status = runCommand(game, command);
+    if (journaled && (command->kind == CMD_LOAD || journalCheckpointDue(journal)) &&
+        journalCheckpoint(journal, game) != 0)
+        sinkPrintf(&game->out, "Warning: the journal checkpoint failed.\n");
+    return status;
+}
+
+void journalClose(Journal *journal)
+{
+    if (journal->fd >= 0)
+        journalCommit(journal);
+    if (journal->fd >= 0)
+        close(journal->fd);
+    free(journal->path);
+    journal->fd = -1;
+    journal->path = NULL;
+}
@@ -0,0 +1,90 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include "hwdec12.h"
+
+// Write-ahead journal of one game session. Every command that can change
+// the game is appended before it runs; a commit makes the appended
+// commands durable with one fdatasync, however many there were. The file
+// starts with a checkpoint (a snapshot of the game) followed by the
+// commands run since, so recovery loads the checkpoint and replays the
+// commands on top of it:
+//
+//   JournalHeader
+//   JournalRecord + snapshot     JOURNAL_CHECKPOINT
+//   JournalRecord + command      JOURNAL_COMMAND, repeated
+//
+// A checkpoint rewrites the journal as a new file holding only the current
+// snapshot and renames it over the old one, so a crash at any point leaves
+// either the old or the new journal. A torn record at the end of the file
+// (a crash in the middle of an append) is dropped during recovery.
+
+#define JOURNAL_MAGIC 0x4e524a4eu // "NJRN"
+#define JOURNAL_VERSION 1
+#define JOURNAL_CHECKPOINT_INTERVAL 1000 // Commands between checkpoints
+
+enum JournalRecordType
+{
+    JOURNAL_CHECKPOINT = 1,
+    JOURNAL_COMMAND = 2
+};
+
+typedef struct JournalHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dungeonId; // Same identification as snapshots
+    uint32_t reserved;
+} JournalHeader;
+
+typedef struct JournalRecord
+{
+    uint32_t type;
+    uint32_t length; // Payload bytes
+    uint32_t crc;    // CRC-32 of the payload
+    uint32_t reserved;
+} JournalRecord;
+
+typedef struct Journal
+{
+    int fd;
+    char *path;
+    long records; // Commands since the last checkpoint
+    int dirty;    // Commands appended but not yet committed
+} Journal;
+
+// Open a journal and recover the game from it: the game is set to the
+// checkpoint and the commands after it are replayed without output. A new
+// journal starts from the game as it is. If the replayed game ended in the
+// player's death the journal starts over with a new game. Returns the
+// number of commands replayed, or -1 on error (message on stderr).
+long journalOpen(Journal *journal, const char *path, GameState *game);
+
+// Run a command with journaling: append it (commands that only show or
+// export the game are left out), handle it, and checkpoint when one is
+// due or the command loaded a save file, whose contents a replay could not
+// reproduce. Returns the GameStatus of the command.
+int journalRun(Journal *journal, GameState *game, const ParsedCommand *command);
+
+// Append a command with a single write. Returns 0 on success.
+int journalAppend(Journal *journal, const char *command);
+
+// Make every appended command durable. Returns 0 on success, also when
+// there was nothing to commit.
+int journalCommit(Journal *journal);
+
+// Commit several journals at once. They have to live on the same file
+// system, which is flushed with a single syncfs, so any number of sessions
+// share one flush. Returns 0 on success.
+int journalCommitGroup(Journal **journals, int count);
+
+// Whether enough commands piled up to make a checkpoint worthwhile
+int journalCheckpointDue(const Journal *journal);
+
+// Replace the journal with a checkpoint of the game. Returns 0 on success.
+int journalCheckpoint(Journal *journal, const GameState *game);
+
+void journalClose(Journal *journal);
+
+#endif // JOURNAL_H
@@ -0,0 +1,291 @@
+// loadgen - local load generator for the game server
+//
+// Usage: loadgen <socket-path> [-c sessions] [-n commands-per-session] [-l]
+//                [-t threads] [-w rooms]
+//
+// Opens the given number of sessions against a running "game --server" and
+// drives them from one epoll loop per thread (one thread by default). Each
+// session sends one command, waits for the answer (which ends with the "> "
+// prompt) and then sends the next, so every command's latency is measured
+// end to end. Reports throughput and the latency distribution. With -l every
+// session first logs in under its own name, so a server started with a
+// journal directory journals it.
+//
+// The commands loop through the stock dungeon. With -w, for a generated
+// world of the given number of rooms, every session instead walks to one of
+// 64 rooms spread evenly over the world and then wanders at random, which
+// keeps all the shards of a sharded server busy.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_EVENTS 256
+#define WANDER_TARGETS 64 // Rooms the wandering sessions spread out from
+
+// A loop through the stock dungeon that never kills the player
+static const char *script[] = {
+    "look", "pickup sword", "move right", "look", "attack", "inventory",
+    "move left", "map", "look", "help",
+};
+#define SCRIPT_LENGTH (int)(sizeof(script) / sizeof(script[0]))
+
+typedef struct Client
+{
+    int fd;
+    int id;
+    int sent;         // Commands sent so far
+    int waiting;      // A command is outstanding
+    double sentAt;    // When the outstanding command was sent
+    char tail[2];     // Last two bytes received, to spot the prompt
+    unsigned random;  // Wandering sessions pick their moves with rand_r
+} Client;
+
+// One thread's share of the sessions
+typedef struct Driver
+{
+    Client *clients;
+    int count;
+    double *latencies; // Room for every command of the driver's sessions
+    long measured;
+    pthread_t thread;
+} Driver;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int connectTo(const char *path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int login;
+static int perSession = 1000;
+static int wanderRooms; // Rooms of the world to wander, 0 to follow the script
+
+static int sendCommand(Client *client)
+{
+    static const char *moves[] = {"move up", "move down", "move left", "move right", "look"};
+    char line[64];
+    int length;
+    int step = client->sent - login;
+    if (login && client->sent == 0)
+        length = snprintf(line, sizeof(line), "login loadgen%d\n", client->id);
+    else if (wanderRooms && step == 0)
+        length = snprintf(line, sizeof(line), "goto %lld\n",
+                          (long long)wanderRooms * (2 * (client->id % WANDER_TARGETS) + 1) / (2 * WANDER_TARGETS));
+    else if (wanderRooms)
+        length = snprintf(line, sizeof(line), "%s\n", moves[rand_r(&client->random) % 5]);
+    else
+        length = snprintf(line, sizeof(line), "%s\n", script[client->sent % SCRIPT_LENGTH]);
+    client->sentAt = now();
+    if (write(client->fd, line, (size_t)length) != length)
+        return -1;
+    client->sent++;
+    client->waiting = 1;
+    return 0;
+}
+
+static void *drive(void *argument)
+{
+    Driver *driver = argument;
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0)
+        return NULL;
+    for (int i = 0; i < driver->count; i++)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &driver->clients[i];
+        epoll_ctl(epoll, EPOLL_CTL_ADD, driver->clients[i].fd, &event);
+    }
+
+    int open = driver->count;
+    struct epoll_event events[MAX_EVENTS];
+    char buffer[65536];
+    while (open > 0)
+    {
+        int count = epoll_wait(epoll, events, MAX_EVENTS, -1);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            break;
+        for (int e = 0; e < count; e++)
+        {
+            Client *client = events[e].data.ptr;
+            ssize_t n = read(client->fd, buffer, sizeof(buffer));
+            if (n <= 0)
+            {
+                fprintf(stderr, "Server closed a session early.\n");
+                close(client->fd);
+                open--;
+                continue;
+            }
+
+            // The answer is complete when the output ends with the prompt
+            char last = buffer[n - 1];
+            char beforeLast = n > 1 ? buffer[n - 2] : client->tail[1];
+            client->tail[0] = beforeLast;
+            client->tail[1] = last;
+            if (beforeLast != '>' || last != ' ')
+                continue;
+
+            if (client->waiting)
+                driver->latencies[driver->measured++] = now() - client->sentAt;
+            client->waiting = 0;
+
+            if (client->sent < perSession)
+            {
+                if (sendCommand(client) != 0)
+                {
+                    close(client->fd);
+                    open--;
+                }
+            }
+            else
+            {
+                close(client->fd);
+                open--;
+            }
+        }
+    }
+    close(epoll);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    const char *usage = "Usage: %s <socket-path> [-c sessions] [-n commands-per-session] [-l] [-t threads] [-w rooms]\n";
+    if (argc < 2)
+    {
+        fprintf(stderr, usage, argv[0]);
+        return 1;
+    }
+    const char *path = argv[1];
+    int sessions = 100;
+    int threads = 1;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-l") == 0)
+            login = 1;
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            sessions = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            perSession = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            wanderRooms = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, usage, argv[0]);
+            return 1;
+        }
+    }
+    if (sessions <= 0 || perSession <= 0 || threads <= 0 || wanderRooms < 0)
+    {
+        fprintf(stderr, "Sessions, commands and threads must be positive.\n");
+        return 1;
+    }
+    if (threads > sessions)
+        threads = sessions;
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    Client *clients = calloc((size_t)sessions, sizeof(Client));
+    double *latencies = malloc(sizeof(double) * (size_t)sessions * (size_t)perSession);
+    Driver *drivers = calloc((size_t)threads, sizeof(Driver));
+    if (!clients || !latencies || !drivers)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    for (int i = 0; i < sessions; i++)
+    {
+        clients[i].id = i;
+        clients[i].random = (unsigned)i * 2654435761u + 1;
+        clients[i].fd = connectTo(path);
+        if (clients[i].fd < 0)
+        {
+            fprintf(stderr, "Cannot connect session %d to %s: %s\n", i, path, strerror(errno));
+            return 1;
+        }
+    }
+
+    // Thread t drives a contiguous share of the sessions
+    double start = now();
+    for (int t = 0; t < threads; t++)
+    {
+        int first = (int)((long)sessions * t / threads);
+        int end = (int)((long)sessions * (t + 1) / threads);
+        drivers[t].clients = clients + first;
+        drivers[t].count = end - first;
+        drivers[t].latencies = latencies + (size_t)first * (size_t)perSession;
+        if (pthread_create(&drivers[t].thread, NULL, drive, &drivers[t]) != 0)
+        {
+            fprintf(stderr, "Cannot start thread %d.\n", t);
+            return 1;
+        }
+    }
+    long measured = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        pthread_join(drivers[t].thread, NULL);
+        memmove(latencies + measured, drivers[t].latencies, sizeof(double) * (size_t)drivers[t].measured);
+        measured += drivers[t].measured;
+    }
+    double elapsed = now() - start;
+
+    qsort(latencies, (size_t)measured, sizeof(double), compareDoubles);
+    printf("%d sessions, %ld commands in %.3f s (%.0f commands/sec)\n",
+           sessions, measured, elapsed, elapsed > 0 ? measured / elapsed : 0.0);
+    if (measured > 0)
+    {
+        printf("latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+               latencies[measured / 2] * 1e6,
+               latencies[(long)(measured * 0.99)] * 1e6,
+               latencies[measured - 1] * 1e6);
+    }
+
+    free(clients);
+    free(latencies);
+    free(drivers);
+    return 0;
+}
@@ -0,0 +1,192 @@
+// game - the terminal game, and the entry point of its replay and server
+// modes
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "baked.h"
+#include "hwdec12.h"
+#include "journal.h"
+#include "replay.h"
+#include "server.h"
+#include "stats.h"
+
+#define INPUT_BLOCK 65536        // Bytes asked for with every read
+#define MAX_COMMAND_LENGTH 65536 // Longer lines are rejected as a whole
+
+// Standard input, read in large blocks. Commands are run in place from the
+// buffer; only an incomplete last line is moved to the front.
+typedef struct Input
+{
+    char *data;
+    size_t length;     // Bytes in data
+    size_t start;      // First byte not yet run
+    size_t capacity;
+    int discarding;    // Dropping the rest of an overlong line
+    int ended;         // End of input was reached
+} Input;
+
+// Next complete line, NUL-terminated in place, or NULL if none is buffered.
+// At the end of input an unterminated last line counts as complete.
+static char *nextLine(Input *input)
+{
+    while (input->start < input->length)
+    {
+        char *line = input->data + input->start;
+        char *newline = memchr(line, '\n', input->length - input->start);
+        if (!newline && !input->ended)
+            return NULL;
+        if (newline)
+            *newline = '\0';
+        else
+            input->data[input->length] = '\0';
+        input->start = newline ? (size_t)(newline + 1 - input->data) : input->length;
+        if (!input->discarding)
+            return line;
+        input->discarding = 0;
+    }
+    return NULL;
+}
+
+// Read another block. Returns 1 if there is more input, 0 at its end and
+// -1 if the line being read is too long and was dropped.
+static int readInput(Input *input)
+{
+    size_t pending = input->length - input->start;
+    if (pending)
+        memmove(input->data, input->data + input->start, pending);
+    input->start = 0;
+    input->length = pending;
+    if (input->discarding)
+        input->length = 0;
+    else if (pending > MAX_COMMAND_LENGTH)
+    {
+        input->length = 0;
+        input->discarding = 1;
+        return -1;
+    }
+
+    if (input->capacity < input->length + INPUT_BLOCK + 1)
+    {
+        char *data = realloc(input->data, input->length + INPUT_BLOCK + 1);
+        if (!data)
+        {
+            fprintf(stderr, "Out of memory reading commands.\n");
+            input->ended = 1;
+            return 0;
+        }
+        input->data = data;
+        input->capacity = input->length + INPUT_BLOCK + 1;
+    }
+
+    ssize_t n;
+    do
+        n = read(STDIN_FILENO, input->data + input->length, INPUT_BLOCK);
+    while (n < 0 && errno == EINTR);
+    if (n <= 0)
+    {
+        input->ended = 1;
+        return 0;
+    }
+    input->length += (size_t)n;
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    Dungeon dungeon;
+    GameState game;
+
+    // The stock dungeon is compiled in, so the game starts without reading
+    // a dungeon file unless it is given one
+    dungeonSetBuiltin(bakedDungeon, bakedDungeonSize);
+
+    if (argc > 1 && strcmp(argv[1], "--replay") == 0)
+        return replayMain(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "--server") == 0)
+        return serverMain(argc - 1, argv + 1);
+
+    // Output of each command, including the next prompt, goes out in one write
+    memset(&game, 0, sizeof(game));
+    sinkInit(&game.out, SINK_BUFFER, STDOUT_FILENO);
+
+    // game [-j journal-file] [dungeon-file]
+    const char *journalPath = NULL;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-j") == 0)
+    {
+        journalPath = argv[2];
+        first = 3;
+    }
+
+    // Initialize game
+    Router router;
+    Journal journal;
+    if (loadRooms(&dungeon, argc > first ? argv[first] : dungeonDefaultPath()) != 0)
+        return 1;
+    routerInit(&router, &dungeon);
+    game.router = &router;
+    if (initializeGame(&game, &dungeon) != 0)
+        return 1;
+
+    // With a journal every command is durable before its answer is shown,
+    // and the game picks up where the last run stopped
+    if (journalPath)
+    {
+        int returning = access(journalPath, F_OK) == 0;
+        if (journalOpen(&journal, journalPath, &game) < 0)
+            return 1;
+        if (returning)
+            sinkPrintf(&game.out, "Your game was restored from %s.\n", journalPath);
+    }
+
+    // Commands are run back to back as long as complete lines are
+    // buffered. Only when the input runs dry are they committed and their
+    // output written, so piped input costs one read and one write per
+    // block rather than per command.
+    Input input;
+    memset(&input, 0, sizeof(input));
+    int status = GAME_CONTINUE;
+    sinkPrintf(&game.out, "\n> ");
+    while (status == GAME_CONTINUE)
+    {
+        char *command = nextLine(&input);
+        if (!command)
+        {
+            if (input.ended)
+                break;
+            if (journalPath && journalCommit(&journal) != 0)
+                sinkPrintf(&game.out, "Warning: the journal could not be written.\n");
+            sinkFlush(&game.out);
+            if (readInput(&input) < 0)
+                sinkPrintf(&game.out, "That command is too long, it was ignored.\n\n> ");
+            continue;
+        }
+
+        ParsedCommand parsed;
+        parseCommand(command, &parsed);
+        if (journalPath)
+            status = journalRun(&journal, &game, &parsed);
+        else
+            status = runCommand(&game, &parsed);
+        if (status == GAME_CONTINUE)
+            sinkPrintf(&game.out, "\n> ");
+    }
+    if (journalPath && journalCommit(&journal) != 0)
+        sinkPrintf(&game.out, "Warning: the journal could not be written.\n");
+    free(input.data);
+    sinkFlush(&game.out);
+
+    // Free allocated resources
+    if (journalPath)
+        journalClose(&journal);
+    freeResources(&game);
+    sinkFree(&game.out);
+    routerFree(&router);
+    dungeonClose(&dungeon);
+
+    STATS_EXIT();
+    return 0;
+}
@@ -0,0 +1,103 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include "output.h"
+#include "stats.h"
+
+#define SINK_INITIAL_CAPACITY 1024
+
+void sinkInit(OutputSink *sink, int kind, int fd)
+{
+    memset(sink, 0, sizeof(*sink));
+    sink->kind = kind;
+    sink->fd = fd;
+}
+
+void sinkFree(OutputSink *sink)
+{
+    free(sink->data);
+    sink->data = NULL;
+    sink->length = sink->sent = sink->capacity = 0;
+}
+
+// Make room for at least extra more bytes
+static int reserve(OutputSink *sink, size_t extra)
+{
+    if (sink->length + extra <= sink->capacity)
+        return 0;
+    size_t capacity = sink->capacity ? sink->capacity : SINK_INITIAL_CAPACITY;
+    while (capacity < sink->length + extra)
+        capacity *= 2;
+    char *data = statsRealloc(sink->data, capacity);
+    if (!data)
+        return -1;
+    sink->data = data;
+    sink->capacity = capacity;
+    return 0;
+}
+
+void sinkPrintf(OutputSink *sink, const char *format, ...)
+{
+    if (sink->kind == SINK_NULL)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    size_t room = sink->capacity - sink->length;
+    int n = vsnprintf(sink->data ? sink->data + sink->length : NULL, room, format, args);
+    va_end(args);
+    if (n < 0)
+        return;
+
+    if ((size_t)n >= room)
+    {
+        // Did not fit: grow and format again
+        if (reserve(sink, (size_t)n + 1) != 0)
+            return;
+        va_start(args, format);
+        vsnprintf(sink->data + sink->length, (size_t)n + 1, format, args);
+        va_end(args);
+    }
+    sink->length += (size_t)n;
+}
+
+void sinkWrite(OutputSink *sink, const void *data, size_t length)
+{
+    if (sink->kind == SINK_NULL || reserve(sink, length) != 0)
+        return;
+    memcpy(sink->data + sink->length, data, length);
+    sink->length += length;
+}
+
+int sinkFlush(OutputSink *sink)
+{
+    if (sink->kind != SINK_BUFFER)
+        return 0;
+
+    while (sink->sent < sink->length)
+    {
+        ssize_t n = write(sink->fd, sink->data + sink->sent, sink->length - sink->sent);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+            sinkReset(sink);
+            return -1;
+        }
+        sink->sent += (size_t)n;
+    }
+    sinkReset(sink);
+    return 0;
+}
+
+void sinkReset(OutputSink *sink)
+{
+    sink->length = 0;
+    sink->sent = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+
+// Destination for everything the game prints. Handlers append to the sink
+// and the caller flushes it once per command (or per batch of commands).
+enum SinkKind
+{
+    SINK_BUFFER,  // Growable buffer, written to fd with a single write on flush
+    SINK_NULL,    // Discard all output without formatting it
+    SINK_CAPTURE  // Keep all output in the buffer until the caller resets it
+};
+
+typedef struct OutputSink
+{
+    int kind;
+    int fd;          // File descriptor SINK_BUFFER flushes to
+    char *data;      // Pending (or captured) output
+    size_t length;   // Bytes in data
+    size_t sent;     // Bytes of data already written by a partial flush
+    size_t capacity; // Allocated size of data
+} OutputSink;
+
+// Initialize a sink, fd is only used by SINK_BUFFER
+void sinkInit(OutputSink *sink, int kind, int fd);
+
+// Release the sink's buffer
+void sinkFree(OutputSink *sink);
+
+// Append formatted text
+void sinkPrintf(OutputSink *sink, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 2, 3)))
+#endif
+    ;
+
+// Append raw bytes
+void sinkWrite(OutputSink *sink, const void *data, size_t length);
+
+// Write pending output of a SINK_BUFFER sink. Returns 0 when everything
+// was written, 1 if the descriptor would block and output is still
+// pending, -1 on error. Other sinks are left untouched.
+int sinkFlush(OutputSink *sink);
+
+// Drop the buffered output (used after reading a SINK_CAPTURE sink)
+void sinkReset(OutputSink *sink);
+
+#endif // OUTPUT_H
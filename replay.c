@@ -0,0 +1,157 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "hwdec12.h"
+#include "replay.h"
+#include "roomcache.h"
+#include "stats.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Read a whole file into a NUL-terminated buffer
+static char *readFile(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    char *buffer = NULL;
+    if (fstat(fd, &st) == 0 && (buffer = statsMalloc((size_t)st.st_size + 1)) != NULL)
+    {
+        size_t got = 0;
+        ssize_t n;
+        while (got < (size_t)st.st_size && (n = read(fd, buffer + got, (size_t)st.st_size - got)) > 0)
+            got += (size_t)n;
+        buffer[got] = '\0';
+        *size = got;
+    }
+    close(fd);
+    return buffer;
+}
+
+// Run one log against a fresh game. Returns the number of commands run.
+static long replayLog(GameState *game, char *log, size_t size, int *status)
+{
+    long commands = 0;
+    char *line = log;
+    char *end = log + size;
+    *status = GAME_CONTINUE;
+    while (line < end && *status == GAME_CONTINUE)
+    {
+        char *next = memchr(line, '\n', (size_t)(end - line));
+        if (next)
+            *next++ = '\0';
+        else
+            next = end;
+
+        line[strcspn(line, "\r")] = '\0';
+        if (line[0] != '\0' && line[0] != '#')
+        {
+            *status = handleCommand(game, line);
+            commands++;
+        }
+        line = next;
+    }
+    return commands;
+}
+
+int replayMain(int argc, char **argv)
+{
+    const char *dungeonPath = dungeonDefaultPath();
+    const char *capturePath = NULL;
+    int first = 1;
+    while (first < argc && argv[first][0] == '-')
+    {
+        if (strcmp(argv[first], "-d") == 0 && first + 1 < argc)
+            dungeonPath = argv[first + 1];
+        else if (strcmp(argv[first], "-o") == 0 && first + 1 < argc)
+            capturePath = argv[first + 1];
+        else
+            break;
+        first += 2;
+    }
+    if (first >= argc)
+    {
+        fprintf(stderr, "Usage: game --replay [-d dungeon-file] [-o capture-file] <log>...\n");
+        return 1;
+    }
+
+    FILE *capture = NULL;
+    if (capturePath && !(capture = fopen(capturePath, "w")))
+    {
+        fprintf(stderr, "Error opening %s.\n", capturePath);
+        return 1;
+    }
+    Dungeon dungeon;
+    if (loadRooms(&dungeon, dungeonPath) != 0)
+        return 1;
+
+    // Game output is either dropped without being formatted or collected
+    // in memory and written to the capture file once per log.
+    GameState game;
+    Router router;
+    memset(&game, 0, sizeof(game));
+    sinkInit(&game.out, capture ? SINK_CAPTURE : SINK_NULL, -1);
+    routerInit(&router, &dungeon);
+    game.router = &router;
+
+    long total = 0;
+    double elapsed = 0;
+    int failed = 0;
+    for (int i = first; i < argc; i++)
+    {
+        size_t size;
+        char *log = readFile(argv[i], &size);
+        if (!log || newGame(&game, &dungeon) != 0)
+        {
+            printf("%s: cannot read log\n", argv[i]);
+            free(log);
+            failed = 1;
+            continue;
+        }
+
+        sinkPrintf(&game.out, "### %s\n", argv[i]);
+
+        int status;
+        double start = now();
+        long commands = replayLog(&game, log, size, &status);
+        elapsed += now() - start;
+        total += commands;
+        free(log);
+
+        if (capture)
+        {
+            fwrite(game.out.data, 1, game.out.length, capture);
+            sinkReset(&game.out);
+        }
+        printf("%s: %ld commands, %s, state %016llx, %zu bytes\n", argv[i], commands,
+                status == GAME_OVER ? "died" : status == GAME_QUIT ? "quit" : "end of log",
+                (unsigned long long)gameStateHash(&game), gameBytesUsed(&game));
+    }
+
+    printf("%ld commands in %.3f s (%.0f commands/sec)\n",
+           total, elapsed, elapsed > 0 ? total / elapsed : 0.0);
+    if (dungeon.cache)
+        printf("Room cache: %llu hits, %llu misses, %llu evictions, %zu bytes\n",
+               (unsigned long long)dungeon.cache->hits, (unsigned long long)dungeon.cache->misses,
+               (unsigned long long)dungeon.cache->evictions, roomCacheBytes(dungeon.cache));
+    if (capture)
+        fclose(capture);
+    freeResources(&game);
+    sinkFree(&game.out);
+    routerFree(&router);
+    dungeonClose(&dungeon);
+    STATS_EXIT();
+    return failed;
+}
@@ -0,0 +1,16 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+// Headless replay of command logs, used for regression and load tests.
+//
+// Usage: game --replay [-d dungeon-file] [-o capture-file] <log>...
+//
+// Every log starts a new game and runs each of its lines through
+// handleCommand exactly as if it had been typed. Game output goes to a
+// null sink, or to a capture sink that is written to the file given with -o. For each log the number of
+// commands and the final state hash are reported on stdout, followed by
+// the overall commands/sec. Empty lines and lines starting with '#' are
+// skipped.
+int replayMain(int argc, char **argv);
+
+#endif // REPLAY_H
@@ -0,0 +1,244 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "roomcache.h"
+#include "stats.h"
+
+#define NO_CHUNK -1
+#define UNREADABLE_CHUNK UINT32_MAX // Number of a chunk whose read failed
+
+struct RoomChunk
+{
+    uint32_t number; // Rooms number * ROOM_CHUNK_ROOMS onwards
+    int newer;       // Neighbours in use order, NO_CHUNK at the ends
+    int older;
+    DungeonRoom *rooms;
+};
+
+static const DungeonRoom emptyRoom = {
+    .exits = {DUNGEON_NO_ROOM, DUNGEON_NO_ROOM, DUNGEON_NO_ROOM, DUNGEON_NO_ROOM},
+};
+
+static uint32_t slotFor(const RoomCache *cache, uint32_t number)
+{
+    return (number * 2654435761u) & cache->indexMask;
+}
+
+int roomCacheInit(RoomCache *cache, int fd, uint64_t offset, uint32_t roomCount, int chunks)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->fd = fd;
+    cache->offset = offset;
+    cache->roomCount = roomCount;
+    cache->newest = NO_CHUNK;
+    cache->oldest = NO_CHUNK;
+    cache->chunkCapacity = chunks > 1 ? chunks : 2;
+
+    // The index stays at most half full
+    uint32_t slots = 4;
+    while (slots < 2u * (uint32_t)cache->chunkCapacity)
+        slots *= 2;
+    cache->indexMask = slots - 1;
+    cache->index = statsMalloc(sizeof(int32_t) * slots);
+    cache->chunks = statsCalloc((size_t)cache->chunkCapacity, sizeof(RoomChunk));
+    if (!cache->index || !cache->chunks)
+    {
+        free(cache->index);
+        free(cache->chunks);
+        cache->index = NULL;
+        cache->chunks = NULL;
+        return -1;
+    }
+    for (uint32_t i = 0; i < slots; i++)
+        cache->index[i] = NO_CHUNK;
+    return 0;
+}
+
+void roomCacheFree(RoomCache *cache)
+{
+    for (int i = 0; i < cache->chunkCount; i++)
+        free(cache->chunks[i].rooms);
+    free(cache->chunks);
+    free(cache->index);
+    if (cache->fd >= 0)
+        close(cache->fd);
+    memset(cache, 0, sizeof(*cache));
+    cache->fd = -1;
+}
+
+static int findChunk(const RoomCache *cache, uint32_t number)
+{
+    for (uint32_t slot = slotFor(cache, number);; slot = (slot + 1) & cache->indexMask)
+    {
+        int chunk = cache->index[slot];
+        if (chunk == NO_CHUNK || cache->chunks[chunk].number == number)
+            return chunk;
+    }
+}
+
+static void indexAdd(RoomCache *cache, int chunk)
+{
+    uint32_t slot = slotFor(cache, cache->chunks[chunk].number);
+    while (cache->index[slot] != NO_CHUNK)
+        slot = (slot + 1) & cache->indexMask;
+    cache->index[slot] = chunk;
+}
+
+// Remove a chunk from the index, shifting later entries of its probe run
+// back so that lookups never need tombstones
+static void indexRemove(RoomCache *cache, int chunk)
+{
+    uint32_t slot = slotFor(cache, cache->chunks[chunk].number);
+    while (cache->index[slot] != chunk)
+    {
+        if (cache->index[slot] == NO_CHUNK)
+            return;
+        slot = (slot + 1) & cache->indexMask;
+    }
+
+    uint32_t hole = slot;
+    for (slot = (hole + 1) & cache->indexMask; cache->index[slot] != NO_CHUNK; slot = (slot + 1) & cache->indexMask)
+    {
+        uint32_t home = slotFor(cache, cache->chunks[cache->index[slot]].number);
+        // Move the entry if its home is not between the hole and its slot
+        if (((slot - home) & cache->indexMask) >= ((slot - hole) & cache->indexMask))
+        {
+            cache->index[hole] = cache->index[slot];
+            hole = slot;
+        }
+    }
+    cache->index[hole] = NO_CHUNK;
+}
+
+static void detach(RoomCache *cache, int chunk)
+{
+    RoomChunk *c = &cache->chunks[chunk];
+    if (c->newer != NO_CHUNK)
+        cache->chunks[c->newer].older = c->older;
+    else
+        cache->newest = c->older;
+    if (c->older != NO_CHUNK)
+        cache->chunks[c->older].newer = c->newer;
+    else
+        cache->oldest = c->newer;
+}
+
+static void linkNewest(RoomCache *cache, int chunk)
+{
+    RoomChunk *c = &cache->chunks[chunk];
+    c->newer = NO_CHUNK;
+    c->older = cache->newest;
+    if (cache->newest != NO_CHUNK)
+        cache->chunks[cache->newest].newer = chunk;
+    else
+        cache->oldest = chunk;
+    cache->newest = chunk;
+}
+
+static void linkOldest(RoomCache *cache, int chunk)
+{
+    RoomChunk *c = &cache->chunks[chunk];
+    c->older = NO_CHUNK;
+    c->newer = cache->oldest;
+    if (cache->oldest != NO_CHUNK)
+        cache->chunks[cache->oldest].older = chunk;
+    else
+        cache->newest = chunk;
+    cache->oldest = chunk;
+}
+
+// A chunk to read into: a new one while the cache is not full, otherwise
+// the least recently used one. Returns NO_CHUNK if memory runs out and
+// nothing can be evicted.
+static int claimChunk(RoomCache *cache)
+{
+    if (cache->chunkCount < cache->chunkCapacity)
+    {
+        DungeonRoom *rooms = statsMalloc(sizeof(DungeonRoom) * ROOM_CHUNK_ROOMS);
+        if (rooms)
+        {
+            cache->chunks[cache->chunkCount].rooms = rooms;
+            return cache->chunkCount++;
+        }
+    }
+    int chunk = cache->oldest;
+    if (chunk == NO_CHUNK)
+        return NO_CHUNK;
+    indexRemove(cache, chunk);
+    detach(cache, chunk);
+    cache->evictions++;
+    return chunk;
+}
+
+static int readChunk(const RoomCache *cache, RoomChunk *chunk)
+{
+    uint64_t first = (uint64_t)chunk->number * ROOM_CHUNK_ROOMS;
+    uint64_t count = cache->roomCount - first;
+    if (count > ROOM_CHUNK_ROOMS)
+        count = ROOM_CHUNK_ROOMS;
+
+    char *data = (char *)chunk->rooms;
+    size_t size = sizeof(DungeonRoom) * (size_t)count;
+    off_t position = (off_t)(cache->offset + sizeof(DungeonRoom) * first);
+    while (size > 0)
+    {
+        ssize_t n = pread(cache->fd, data, size, position);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        size -= (size_t)n;
+        position += n;
+    }
+    return 0;
+}
+
+const DungeonRoom *roomCacheGet(RoomCache *cache, int room)
+{
+    uint32_t number = (uint32_t)room / ROOM_CHUNK_ROOMS;
+    int offset = room % ROOM_CHUNK_ROOMS;
+
+    // Most lookups stay in the chunk of the previous one
+    if (cache->newest != NO_CHUNK && cache->chunks[cache->newest].number == number)
+    {
+        cache->hits++;
+        return &cache->chunks[cache->newest].rooms[offset];
+    }
+
+    int chunk = findChunk(cache, number);
+    if (chunk != NO_CHUNK)
+    {
+        cache->hits++;
+        detach(cache, chunk);
+        linkNewest(cache, chunk);
+        return &cache->chunks[chunk].rooms[offset];
+    }
+
+    cache->misses++;
+    chunk = claimChunk(cache);
+    if (chunk == NO_CHUNK)
+        return &emptyRoom;
+    cache->chunks[chunk].number = number;
+    if (readChunk(cache, &cache->chunks[chunk]) != 0)
+    {
+        // Kept as the oldest chunk, outside the index, to be reused first
+        fprintf(stderr, "Error reading rooms %u to %u of the dungeon file.\n",
+                number * ROOM_CHUNK_ROOMS, number * ROOM_CHUNK_ROOMS + ROOM_CHUNK_ROOMS - 1);
+        cache->chunks[chunk].number = UNREADABLE_CHUNK;
+        linkOldest(cache, chunk);
+        return &emptyRoom;
+    }
+    indexAdd(cache, chunk);
+    linkNewest(cache, chunk);
+    return &cache->chunks[chunk].rooms[offset];
+}
+
+size_t roomCacheBytes(const RoomCache *cache)
+{
+    return sizeof(DungeonRoom) * ROOM_CHUNK_ROOMS * (size_t)cache->chunkCount +
+           sizeof(RoomChunk) * (size_t)cache->chunkCapacity + sizeof(int32_t) * ((size_t)cache->indexMask + 1);
+}
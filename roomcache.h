@@ -0,0 +1,58 @@
+#ifndef ROOMCACHE_H
+#define ROOMCACHE_H
+
+#include <stdint.h>
+#include "dungeon.h"
+
+// Demand-paged room records. The room section of a dungeon file is split
+// into chunks of ROOM_CHUNK_ROOMS rooms, and a chunk is read from the file
+// the first time one of its rooms is used. At most a fixed number of chunks
+// is resident; when the cache is full the least recently used chunk makes
+// room. Room records never change during play (session changes live in the
+// RoomTable), so chunks are always clean and eviction never writes back.
+//
+// Memory is bounded by the number of chunks whatever the size of the world,
+// and opening costs nothing until the first room is used.
+//
+// A cache is not thread-safe. The server opens the dungeon once per shard,
+// so each cache belongs to one shard and is only used from its thread.
+
+#define ROOM_CHUNK_ROOMS 1024     // Rooms read at once, about 44 KB
+#define ROOM_CACHE_DEFAULT_CHUNKS 64
+
+typedef struct RoomChunk RoomChunk;
+
+struct RoomCache
+{
+    int fd;
+    uint64_t offset;       // File offset of the room section
+    uint32_t roomCount;
+    RoomChunk *chunks;     // Resident chunks, chunkCount of them in use
+    int chunkCount;
+    int chunkCapacity;
+    int32_t *index;        // Chunk number -> slot in chunks, open addressing
+    uint32_t indexMask;
+    int newest;            // Most recently used chunk, -1 if none
+    int oldest;            // Least recently used chunk, -1 if none
+    uint64_t hits;         // Rooms found in a resident chunk
+    uint64_t misses;       // Rooms whose chunk had to be read
+    uint64_t evictions;    // Chunks dropped to make room
+};
+
+// Prepare a cache of at most chunks chunks over the room section of an open
+// dungeon file. Returns 0 on success, -1 if memory runs out. On success
+// the cache owns fd.
+int roomCacheInit(RoomCache *cache, int fd, uint64_t offset, uint32_t roomCount, int chunks);
+
+// Close the file and release every chunk
+void roomCacheFree(RoomCache *cache);
+
+// Record of a room (0 <= room < roomCount). The pointer stays valid until
+// rooms of chunks - 1 other chunks have been used. If the file cannot be
+// read, an empty room without exits is returned.
+const DungeonRoom *roomCacheGet(RoomCache *cache, int room);
+
+// Bytes held for chunks and the chunk index
+size_t roomCacheBytes(const RoomCache *cache);
+
+#endif // ROOMCACHE_H
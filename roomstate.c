@@ -0,0 +1,75 @@
+#include <string.h>
+#include "roomstate.h"
+
+#define ROOM_TABLE_INITIAL_CAPACITY 16
+
+static uint32_t slotFor(const RoomTable *table, uint32_t key)
+{
+    return (key * 2654435761u) & (table->capacity - 1);
+}
+
+void roomTableInit(RoomTable *table, Arena *arena)
+{
+    memset(table, 0, sizeof(*table));
+    table->arena = arena;
+}
+
+const RoomState *roomTableFind(const RoomTable *table, int room)
+{
+    if (table->capacity == 0)
+        return NULL;
+    uint32_t key = (uint32_t)room + 1;
+    for (uint32_t slot = slotFor(table, key);; slot = (slot + 1) & (table->capacity - 1))
+    {
+        if (table->keys[slot] == key)
+            return &table->states[slot];
+        if (table->keys[slot] == 0)
+            return NULL;
+    }
+}
+
+static int grow(RoomTable *table)
+{
+    RoomTable bigger;
+    bigger.capacity = table->capacity ? table->capacity * 2 : ROOM_TABLE_INITIAL_CAPACITY;
+    bigger.count = table->count;
+    bigger.arena = table->arena;
+    bigger.keys = arenaCalloc(table->arena, bigger.capacity, sizeof(uint32_t));
+    bigger.states = arenaAlloc(table->arena, sizeof(RoomState) * bigger.capacity);
+    if (!bigger.keys || !bigger.states)
+        return -1;
+
+    for (uint32_t i = 0; i < table->capacity; i++)
+    {
+        if (table->keys[i] == 0)
+            continue;
+        uint32_t slot = slotFor(&bigger, table->keys[i]);
+        while (bigger.keys[slot] != 0)
+            slot = (slot + 1) & (bigger.capacity - 1);
+        bigger.keys[slot] = table->keys[i];
+        bigger.states[slot] = table->states[i];
+    }
+
+    *table = bigger;
+    return 0;
+}
+
+RoomState *roomTableGet(RoomTable *table, int room)
+{
+    RoomState *state = (RoomState *)roomTableFind(table, room);
+    if (state)
+        return state;
+
+    // Keep the load factor at or below 1/2
+    if ((table->count + 1) * 2 > table->capacity && grow(table) != 0)
+        return NULL;
+
+    uint32_t key = (uint32_t)room + 1;
+    uint32_t slot = slotFor(table, key);
+    while (table->keys[slot] != 0)
+        slot = (slot + 1) & (table->capacity - 1);
+    table->keys[slot] = key;
+    memset(&table->states[slot], 0, sizeof(RoomState));
+    table->count++;
+    return &table->states[slot];
+}
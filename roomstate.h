@@ -0,0 +1,46 @@
+#ifndef ROOMSTATE_H
+#define ROOMSTATE_H
+
+#include <stdint.h>
+#include "arena.h"
+
+// Rooms themselves are read in place from the dungeon file (DungeonRoom).
+// Only what changes during play is kept here. A zeroed RoomState means the
+// room is exactly as the dungeon file describes it.
+typedef struct RoomState
+{
+    int creatureDamage;  // Damage dealt to the room's creature
+    int dirty;           // Changed since the session's last save
+    uint64_t itemsTaken; // Bit i is set once the item in slot i was picked up
+} RoomState;
+
+// Sparse per-session room state: only rooms the session changed have an
+// entry, so a session costs the same in a five-room dungeon as in a world
+// with millions of rooms. Open addressing with linear probing.
+//
+// The table lives in its session's arena. Growing leaves the old arrays
+// behind in the arena, which at most doubles what the table occupies; it
+// is all released when the session's arena is reset or freed.
+typedef struct RoomTable
+{
+    uint32_t *keys;     // Room index + 1 of each slot, 0 when the slot is empty
+    RoomState *states;
+    uint32_t capacity;  // Power of two, 0 until the first insertion
+    uint32_t count;
+    Arena *arena;       // Where the arrays are allocated
+} RoomTable;
+
+// Start an empty table allocating from arena
+void roomTableInit(RoomTable *table, Arena *arena);
+
+// State of a room, NULL if the room was never changed
+const RoomState *roomTableFind(const RoomTable *table, int room);
+
+// State of a room for modification, inserting a zeroed entry if needed.
+// Returns NULL if memory runs out.
+RoomState *roomTableGet(RoomTable *table, int room);
+
+// Iterate over entries: for (i = 0; i < capacity; i++) if (keys[i]) ...
+#define roomTableRoom(table, slot) ((int)(table)->keys[slot] - 1)
+
+#endif // ROOMSTATE_H
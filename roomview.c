@@ -0,0 +1,51 @@
+#include <string.h>
+#include "roomview.h"
+
+static RoomView *slotOf(const RoomViews *views, int room)
+{
+    return &views->views[(uint32_t)room & (ROOM_VIEW_SLOTS - 1)];
+}
+
+void roomViewsInit(RoomViews *views, Arena *arena)
+{
+    views->views = NULL;
+    views->arena = arena;
+}
+
+const RoomView *roomViewFind(const RoomViews *views, int room, uint64_t capabilities)
+{
+    if (!views->views)
+        return NULL;
+    const RoomView *view = slotOf(views, room);
+    if (view->room != room || view->capabilities != capabilities)
+        return NULL;
+    return view;
+}
+
+void roomViewStore(RoomViews *views, int room, uint64_t capabilities, const char *text, size_t length)
+{
+    if (length > ROOM_VIEW_BYTES)
+        return;
+    if (!views->views)
+    {
+        views->views = arenaAlloc(views->arena, sizeof(RoomView) * ROOM_VIEW_SLOTS);
+        if (!views->views)
+            return;
+        for (int i = 0; i < ROOM_VIEW_SLOTS; i++)
+            views->views[i].room = -1;
+    }
+    RoomView *view = slotOf(views, room);
+    view->room = room;
+    view->length = (uint32_t)length;
+    view->capabilities = capabilities;
+    memcpy(view->text, text, length);
+}
+
+void roomViewInvalidate(RoomViews *views, int room)
+{
+    if (!views->views)
+        return;
+    RoomView *view = slotOf(views, room);
+    if (view->room == room)
+        view->room = -1;
+}
@@ -0,0 +1,46 @@
+#ifndef ROOMVIEW_H
+#define ROOMVIEW_H
+
+#include <stdint.h>
+#include "arena.h"
+
+// Rendered look output of the rooms a session looked at last, so looking
+// again at an unchanged room copies bytes instead of formatting them anew.
+// A view is direct-mapped by room and tagged with the capabilities it was
+// rendered with, so a pickup or kill anywhere that changes the room's
+// description variant misses by itself. Changes to the room's own items or
+// creature invalidate its view explicitly.
+//
+// Like the room table, the views live in the session's arena and are
+// allocated on the first store.
+
+#define ROOM_VIEW_SLOTS 8   // Views kept per session, a power of two
+#define ROOM_VIEW_BYTES 240 // Longer output is not cached
+
+typedef struct RoomView
+{
+    int32_t room; // -1 when the slot is empty
+    uint32_t length;
+    uint64_t capabilities;
+    char text[ROOM_VIEW_BYTES];
+} RoomView;
+
+typedef struct RoomViews
+{
+    RoomView *views; // ROOM_VIEW_SLOTS entries, NULL until the first store
+    Arena *arena;
+} RoomViews;
+
+// Start without any views, allocating from arena
+void roomViewsInit(RoomViews *views, Arena *arena);
+
+// View of a room rendered with these capabilities, NULL if there is none
+const RoomView *roomViewFind(const RoomViews *views, int room, uint64_t capabilities);
+
+// Keep the output of a room, unless it is too long or memory runs out
+void roomViewStore(RoomViews *views, int room, uint64_t capabilities, const char *text, size_t length);
+
+// Forget the view of a room after it changed
+void roomViewInvalidate(RoomViews *views, int room);
+
+#endif // ROOMVIEW_H
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include "route.h"
+#include "stats.h"
+
+#define STEP_NONE 0xff // Target not reachable from the room
+#define STEP_HERE 0xfe // The room is the target
+#define EDGE_OPEN 0xff // Edge without a gate
+
+struct RouteTable
+{
+    uint64_t capabilities;
+    int target;
+    uint8_t *steps;   // Direction of the first move from every room
+    uint64_t lastUsed;
+};
+
+void routerInit(Router *router, const Dungeon *dungeon)
+{
+    memset(router, 0, sizeof(*router));
+    router->dungeon = dungeon;
+}
+
+void routerFree(Router *router)
+{
+    for (int i = 0; i < router->tableCount; i++)
+        free(router->tables[i].steps);
+    free(router->tables);
+    free(router->edgeStart);
+    free(router->edges);
+    free(router->edgeGates);
+    free(router->queue);
+    routerInit(router, router->dungeon);
+}
+
+static int validRoom(const Dungeon *dungeon, int32_t room)
+{
+    return room >= 0 && room < dungeon->roomCount;
+}
+
+// Build the reversed room graph once, in compressed sparse row form
+static int buildEdges(Router *router)
+{
+    const Dungeon *dungeon = router->dungeon;
+    size_t rooms = (size_t)dungeon->roomCount;
+    router->edgeStart = statsCalloc(rooms + 1, sizeof(uint32_t));
+    router->queue = statsMalloc(sizeof(int32_t) * rooms);
+    if (!router->edgeStart || !router->queue)
+        return -1;
+
+    uint32_t edgeCount = 0;
+    for (size_t r = 0; r < rooms; r++)
+    {
+        for (int d = 0; d < DIR_COUNT; d++)
+        {
+            int32_t to = dungeonRoom(dungeon, (int)r)->exits[d];
+            if (validRoom(dungeon, to))
+            {
+                router->edgeStart[to + 1]++;
+                edgeCount++;
+            }
+        }
+    }
+    for (size_t r = 0; r < rooms; r++)
+        router->edgeStart[r + 1] += router->edgeStart[r];
+
+    router->edges = statsMalloc(sizeof(uint32_t) * ((size_t)edgeCount + 1));
+    router->edgeGates = statsMalloc((size_t)edgeCount + 1);
+    uint32_t *fill = statsMalloc(sizeof(uint32_t) * (rooms + 1));
+    if (!router->edges || !router->edgeGates || !fill)
+    {
+        free(fill);
+        return -1;
+    }
+    memcpy(fill, router->edgeStart, sizeof(uint32_t) * (rooms + 1));
+    for (size_t r = 0; r < rooms; r++)
+    {
+        for (int d = 0; d < DIR_COUNT; d++)
+        {
+            int32_t to = dungeonRoom(dungeon, (int)r)->exits[d];
+            if (!validRoom(dungeon, to))
+                continue;
+            // Gates are looked up once here, in room order, so that the
+            // searches never touch the rooms themselves
+            const DungeonGate *gate = dungeonExitGate(dungeon, (int)r, d);
+            router->edgeGates[fill[to]] = gate ? (uint8_t)gate->requirement : EDGE_OPEN;
+            router->edges[fill[to]++] = (uint32_t)(r * DIR_COUNT + (size_t)d);
+        }
+    }
+    free(fill);
+    return 0;
+}
+
+// Breadth-first search from the target over reversed edges. Each room
+// reached records the direction of its edge, i.e. its first step.
+static void buildTable(Router *router, RouteTable *table)
+{
+    const Dungeon *dungeon = router->dungeon;
+    uint64_t capabilities = table->capabilities;
+    memset(table->steps, STEP_NONE, (size_t)dungeon->roomCount);
+    table->steps[table->target] = STEP_HERE;
+
+    int32_t *queue = router->queue;
+    size_t head = 0, tail = 0;
+    queue[tail++] = table->target;
+    while (head < tail)
+    {
+        int32_t room = queue[head++];
+        for (uint32_t e = router->edgeStart[room]; e < router->edgeStart[room + 1]; e++)
+        {
+            int from = (int)(router->edges[e] / DIR_COUNT);
+            int direction = (int)(router->edges[e] % DIR_COUNT);
+            uint8_t gate = router->edgeGates[e];
+            if (table->steps[from] != STEP_NONE || (gate != EDGE_OPEN && !((capabilities >> gate) & 1)))
+                continue;
+            table->steps[from] = (uint8_t)direction;
+            queue[tail++] = from;
+        }
+    }
+    router->builds++;
+}
+
+static const RouteTable *findTable(Router *router, uint64_t capabilities, int target)
+{
+    const Dungeon *dungeon = router->dungeon;
+    if (dungeon->requirementCount < 64)
+        capabilities &= (1ull << dungeon->requirementCount) - 1;
+
+    router->clock++;
+    for (int i = 0; i < router->tableCount; i++)
+    {
+        RouteTable *table = &router->tables[i];
+        if (table->target == target && table->capabilities == capabilities)
+        {
+            table->lastUsed = router->clock;
+            router->hits++;
+            return table;
+        }
+    }
+
+    if (!router->edgeStart && buildEdges(router) != 0)
+        return NULL;
+
+    if (router->tableCapacity == 0)
+    {
+        size_t fit = ROUTE_CACHE_BYTES / ((size_t)dungeon->roomCount + 1);
+        router->tableCapacity = fit < ROUTE_CACHE_MIN_TABLES ? ROUTE_CACHE_MIN_TABLES : fit > 64 ? 64 : (int)fit;
+        router->tables = statsCalloc((size_t)router->tableCapacity, sizeof(RouteTable));
+        if (!router->tables)
+        {
+            router->tableCapacity = 0;
+            return NULL;
+        }
+    }
+
+    // Use a free table or evict the least recently used one
+    RouteTable *table;
+    if (router->tableCount < router->tableCapacity)
+    {
+        table = &router->tables[router->tableCount];
+        table->steps = statsMalloc((size_t)dungeon->roomCount);
+        if (!table->steps)
+            return NULL;
+        router->tableCount++;
+    }
+    else
+    {
+        table = &router->tables[0];
+        for (int i = 1; i < router->tableCount; i++)
+        {
+            if (router->tables[i].lastUsed < table->lastUsed)
+                table = &router->tables[i];
+        }
+    }
+
+    table->capabilities = capabilities;
+    table->target = target;
+    table->lastUsed = router->clock;
+    buildTable(router, table);
+    return table;
+}
+
+int routerStep(Router *router, uint64_t capabilities, int from, int target)
+{
+    if (!validRoom(router->dungeon, from) || !validRoom(router->dungeon, target))
+        return ROUTE_UNREACHABLE;
+    if (from == target)
+        return ROUTE_ARRIVED;
+    const RouteTable *table = findTable(router, capabilities, target);
+    if (!table)
+        return ROUTE_ERROR;
+    return table->steps[from] == STEP_NONE ? ROUTE_UNREACHABLE : table->steps[from];
+}
+
+int routerRoute(Router *router, uint64_t capabilities, int from, int target, int32_t *rooms, int maxRooms)
+{
+    if (!validRoom(router->dungeon, from) || !validRoom(router->dungeon, target))
+        return ROUTE_UNREACHABLE;
+    if (from == target)
+        return 0;
+    const RouteTable *table = findTable(router, capabilities, target);
+    if (!table)
+        return ROUTE_ERROR;
+    if (table->steps[from] == STEP_NONE)
+        return ROUTE_UNREACHABLE;
+
+    int moves = 0;
+    for (int room = from; room != target; moves++)
+    {
+        room = dungeonRoom(router->dungeon, room)->exits[table->steps[room]];
+        if (moves < maxRooms)
+            rooms[moves] = room;
+    }
+    return moves;
+}
@@ -0,0 +1,55 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include <stdint.h>
+#include "dungeon.h"
+
+// Shortest routes through a dungeon that respect its gates. Which exits
+// are open depends only on the player's capability mask, so routes are
+// precomputed per (capabilities, target room) as a table holding, for
+// every room, the first step towards the target. A table is built with one
+// breadth-first search over the reversed room graph; after that every
+// query costs O(path length). Tables are cached and shared by all sessions
+// of the dungeon, and a session whose capabilities change simply moves on
+// to the tables for its new mask.
+//
+// A router is not thread-safe; use one per thread.
+
+#define ROUTE_UNREACHABLE -1 // No way to the target with these capabilities
+#define ROUTE_ARRIVED -2     // Already at the target
+#define ROUTE_ERROR -3       // Out of memory
+
+#define ROUTE_CACHE_BYTES (64u << 20) // Memory for cached route tables
+#define ROUTE_CACHE_MIN_TABLES 4      // Kept even when a table is bigger
+
+typedef struct RouteTable RouteTable;
+
+typedef struct Router
+{
+    const Dungeon *dungeon;
+    uint32_t *edgeStart; // Reversed graph: edges into room r are
+    uint32_t *edges;     // edges[edgeStart[r]..edgeStart[r+1]), room * DIR_COUNT + direction
+    uint8_t *edgeGates;  // Requirement of the gate on each edge, 0xff if none
+    int32_t *queue;
+    RouteTable *tables;
+    int tableCount;
+    int tableCapacity;
+    uint64_t clock;    // For least recently used eviction
+    long hits;         // Queries answered from a cached table
+    long builds;       // Tables built
+} Router;
+
+// Prepare a router for a dungeon. Memory is only allocated on first use.
+void routerInit(Router *router, const Dungeon *dungeon);
+void routerFree(Router *router);
+
+// Direction of the first move from room from towards room target, or
+// ROUTE_ARRIVED, ROUTE_UNREACHABLE or ROUTE_ERROR
+int routerStep(Router *router, uint64_t capabilities, int from, int target);
+
+// Rooms along the shortest route, rooms[i] being the room reached by move
+// i + 1. Stores at most maxRooms rooms and returns the number of moves, or
+// ROUTE_UNREACHABLE or ROUTE_ERROR.
+int routerRoute(Router *router, uint64_t capabilities, int from, int target, int32_t *rooms, int maxRooms);
+
+#endif // ROUTE_H
@@ -0,0 +1,821 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // For strncasecmp()
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hwdec12.h"
+#include "server.h"
+#include "journal.h"
+#include "roomcache.h"
+#include "spsc.h"
+#include "stats.h"
+
+#define SERVER_MAX_EVENTS 256
+#define SESSION_INPUT_SIZE 1024
+#define MAX_PLAYER_NAME 64
+#define HANDOFF_QUEUE_SIZE 1024 // Sessions on their way from one shard to another
+
+typedef struct Session
+{
+    int fd;
+    GameState game;
+    char input[SESSION_INPUT_SIZE]; // Received bytes not yet handled
+    size_t inputLength;
+    int discarding;  // Dropping the rest of an overlong line
+    int closing;     // Close once the pending output is written
+    int waitingOut;  // Reading is paused until the output drains
+    int journaled;   // Logged in, commands go through the journal
+    Journal journal;
+    int commitPending;           // Output is held back until the next commit
+    struct Session *nextCommit;  // Sessions waiting for the commit
+    struct Session *prev, *next;
+    int destination;             // Shard the session is being handed to
+    struct Session *nextBlocked; // Handoffs waiting for room in a full queue
+} Session;
+
+typedef struct Shard Shard;
+
+// What all shards share. Apart from the handoff queues and the names of
+// the players logged in, shards share nothing while they play.
+typedef struct Server
+{
+    int listener;
+    const char *journalDir; // Where journals are kept, NULL without journaling
+    int roomCount;
+    int shardCount;
+    Shard *shards;
+    SpscQueue *handoffs;  // From shard i to shard j at i * shardCount + j
+    int stopping;         // Set by the main thread (atomic)
+    int sessionCount;     // Open sessions of all shards (atomic)
+    int peakSessions;     // Only updated by the shard that accepts
+    long sessionsServed;
+    pthread_mutex_t playersLock;
+    char **players;       // Journal paths of the players logged in
+    int playerCount;
+    int playerCapacity;
+} Server;
+
+// A thread with its own event loop, owning a contiguous range of rooms:
+// room r belongs to shard r * shardCount / roomCount. It hosts the sessions
+// whose players are in its rooms, and opens the dungeon and keeps routes of
+// its own, so the rooms it serves stay in its own room cache. A player who
+// walks out of the range is handed to the shard owning the new room.
+struct Shard
+{
+    Server *server;
+    int index;
+    pthread_t thread;
+    int epoll;
+    int wakeup;      // eventfd, written when sessions are handed to the shard
+    Dungeon dungeon;
+    Router router;   // Routes are shared by the shard's sessions
+    Session *commitQueue;
+    int commitQueueLength;
+    long commits; // Group commits, each one flush for every waiting session
+    Session *sessions;
+    Session *blocked; // Handed off, but the queue to their shard was full
+    long commands;
+    long handoffs;           // Sessions handed to other shards
+    size_t sessionBytes;     // Memory of all closed sessions together
+    size_t peakSessionBytes; // Largest closed session
+};
+
+static int shardOf(const Server *server, int room)
+{
+    return (int)((int64_t)room * server->shardCount / server->roomCount);
+}
+
+// Reserve a player's journal for one session. Returns 0 on success, -1 if
+// another session already plays it.
+static int claimPlayer(Server *server, const char *path)
+{
+    int result = -1;
+    pthread_mutex_lock(&server->playersLock);
+    int i = 0;
+    while (i < server->playerCount && strcmp(server->players[i], path) != 0)
+        i++;
+    if (i == server->playerCount)
+    {
+        if (server->playerCount == server->playerCapacity)
+        {
+            int capacity = server->playerCapacity ? 2 * server->playerCapacity : 16;
+            char **players = statsRealloc(server->players, sizeof(char *) * (size_t)capacity);
+            if (players)
+            {
+                server->players = players;
+                server->playerCapacity = capacity;
+            }
+        }
+        char *copy = server->playerCount < server->playerCapacity ? statsStrdup(path) : NULL;
+        if (copy)
+        {
+            server->players[server->playerCount++] = copy;
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&server->playersLock);
+    return result;
+}
+
+static void releasePlayer(Server *server, const char *path)
+{
+    pthread_mutex_lock(&server->playersLock);
+    for (int i = 0; i < server->playerCount; i++)
+    {
+        if (strcmp(server->players[i], path) == 0)
+        {
+            free(server->players[i]);
+            server->players[i] = server->players[--server->playerCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->playersLock);
+}
+
+// Add a session to the shard's event loop
+static int attachSession(Shard *shard, Session *session)
+{
+    struct epoll_event event;
+    event.events = session->waitingOut ? EPOLLOUT : EPOLLIN;
+    event.data.ptr = session;
+    if (epoll_ctl(shard->epoll, EPOLL_CTL_ADD, session->fd, &event) != 0)
+        return -1;
+    session->game.dungeon = &shard->dungeon;
+    session->game.router = &shard->router;
+    session->prev = NULL;
+    session->next = shard->sessions;
+    if (shard->sessions)
+        shard->sessions->prev = session;
+    shard->sessions = session;
+    return 0;
+}
+
+static void detachSession(Shard *shard, Session *session)
+{
+    epoll_ctl(shard->epoll, EPOLL_CTL_DEL, session->fd, NULL);
+    if (session->prev)
+        session->prev->next = session->next;
+    else
+        shard->sessions = session->next;
+    if (session->next)
+        session->next->prev = session->prev;
+    session->prev = session->next = NULL;
+}
+
+// Free a session that is not attached to any shard
+static void freeSession(Shard *shard, Session *session)
+{
+    close(session->fd);
+    if (session->journaled)
+    {
+        releasePlayer(shard->server, session->journal.path);
+        journalClose(&session->journal);
+    }
+    size_t bytes = sizeof(Session) + gameBytesUsed(&session->game);
+    shard->sessionBytes += bytes;
+    if (bytes > shard->peakSessionBytes)
+        shard->peakSessionBytes = bytes;
+    freeResources(&session->game);
+    sinkFree(&session->game.out);
+    free(session);
+    __atomic_sub_fetch(&shard->server->sessionCount, 1, __ATOMIC_RELAXED);
+}
+
+// Take the session off the shard's commit queue, if it waits there
+static void dequeueCommit(Shard *shard, Session *session)
+{
+    if (!session->commitPending)
+        return;
+    Session **link = &shard->commitQueue;
+    while (*link != session)
+        link = &(*link)->nextCommit;
+    *link = session->nextCommit;
+    shard->commitQueueLength--;
+    session->commitPending = 0;
+}
+
+static void closeSession(Shard *shard, Session *session)
+{
+    detachSession(shard, session);
+    dequeueCommit(shard, session);
+    freeSession(shard, session);
+}
+
+// Flush the session's output. While output is pending the session only
+// waits for the socket to become writable, which also throttles clients
+// that send commands faster than they read the answers.
+static int flushSession(Shard *shard, Session *session)
+{
+    int result = sinkFlush(&session->game.out);
+    if (result < 0 || (result == 0 && session->closing))
+    {
+        closeSession(shard, session);
+        return -1;
+    }
+
+    int waitingOut = result == 1;
+    if (waitingOut != session->waitingOut)
+    {
+        struct epoll_event event;
+        event.events = waitingOut ? EPOLLOUT : EPOLLIN;
+        event.data.ptr = session;
+        epoll_ctl(shard->epoll, EPOLL_CTL_MOD, session->fd, &event);
+        session->waitingOut = waitingOut;
+    }
+    return 0;
+}
+
+// Queue a handed off session for its shard. Returns 0 on success, -1 if
+// the queue is full.
+static int sendSession(Shard *shard, Session *session)
+{
+    Server *server = shard->server;
+    Shard *to = &server->shards[session->destination];
+    if (spscPush(&server->handoffs[shard->index * server->shardCount + to->index], session) != 0)
+        return -1;
+    uint64_t one = 1;
+    if (write(to->wakeup, &one, sizeof(one)) < 0)
+        perror("eventfd");
+    return 0;
+}
+
+// The player left the shard's rooms: pass the session on to the shard that
+// owns the room it is in now. Pending output and input go with it, and the
+// shard it arrives at carries on where this one stopped. A commit queued
+// for an earlier read goes too: the journal is still dirty, so the new
+// shard queues the session for its own commit.
+static void handOff(Shard *shard, Session *session)
+{
+    detachSession(shard, session);
+    dequeueCommit(shard, session);
+    session->destination = shardOf(shard->server, session->game.player.currentRoom);
+    shard->handoffs++;
+    if (sendSession(shard, session) != 0)
+    {
+        session->nextBlocked = shard->blocked;
+        shard->blocked = session;
+    }
+}
+
+static void retryHandoffs(Shard *shard)
+{
+    Session **link = &shard->blocked;
+    while (*link)
+    {
+        Session *session = *link;
+        if (sendSession(shard, session) == 0)
+            *link = session->nextBlocked;
+        else
+            link = &session->nextBlocked;
+    }
+}
+
+// login <name>: resume the player's journaled game
+static void login(Shard *shard, Session *session, const char *name)
+{
+    size_t length = strlen(name);
+    if (length == 0 || length > MAX_PLAYER_NAME || strspn(name, "abcdefghijklmnopqrstuvwxyz0123456789_-") != length)
+    {
+        sinkPrintf(&session->game.out, "Names are 1 to %d letters, digits, '_' or '-'.\n", MAX_PLAYER_NAME);
+        return;
+    }
+    if (session->journaled)
+    {
+        sinkPrintf(&session->game.out, "You are already logged in.\n");
+        return;
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.journal", shard->server->journalDir, name);
+    if (claimPlayer(shard->server, path) != 0)
+    {
+        sinkPrintf(&session->game.out, "%s is already playing.\n", name);
+        return;
+    }
+
+    // Start from a new game, the journal then restores the player's own
+    int returning = access(path, F_OK) == 0;
+    if (newGame(&session->game, &shard->dungeon) != 0)
+    {
+        releasePlayer(shard->server, path);
+        return;
+    }
+    long replayed = journalOpen(&session->journal, path, &session->game);
+    if (replayed < 0)
+    {
+        releasePlayer(shard->server, path);
+        sinkPrintf(&session->game.out, "Your game could not be restored.\n");
+        return;
+    }
+    session->journaled = 1;
+    if (returning)
+        sinkPrintf(&session->game.out, "Welcome back, %s. Your game was restored.\n", name);
+    else
+        sinkPrintf(&session->game.out, "Welcome, %s. Your progress is saved as you play.\n", name);
+}
+
+// Run every complete line in the input buffer. Returns 1 if the player
+// left the shard's rooms, in which case the remaining lines are left to
+// the shard that owns the player's new room.
+static int handleInput(Shard *shard, Session *session)
+{
+    char *start = session->input;
+    char *end = session->input + session->inputLength;
+    int moved = 0;
+    while (!session->closing && !moved)
+    {
+        char *newline = memchr(start, '\n', (size_t)(end - start));
+        if (!newline)
+        {
+            // A line that fills the whole buffer is rejected as a whole,
+            // like an overlong line in the terminal game
+            if (start != session->input || session->inputLength < SESSION_INPUT_SIZE - 1)
+                break;
+            if (!session->discarding)
+                sinkPrintf(&session->game.out, "That command is too long, it was ignored.\n\n> ");
+            session->discarding = 1;
+            start = end;
+            break;
+        }
+        *newline = '\0';
+        if (session->discarding)
+        {
+            session->discarding = 0;
+            start = newline + 1;
+            continue;
+        }
+        start[strcspn(start, "\r")] = '\0';
+        shard->commands++;
+        int status = GAME_CONTINUE;
+        if (shard->server->journalDir && strncasecmp(start, "login ", 6) == 0)
+        {
+            // Names are case-insensitive, the journal is named in lowercase
+            toLowerCase(start + 6);
+            login(shard, session, start + 6);
+        }
+        else
+        {
+            ParsedCommand command;
+            parseCommand(start, &command);
+            if (session->journaled)
+                status = journalRun(&session->journal, &session->game, &command);
+            else
+                status = runCommand(&session->game, &command);
+        }
+        if (status != GAME_CONTINUE)
+            session->closing = 1;
+        else
+        {
+            sinkPrintf(&session->game.out, "\n> ");
+            moved = shardOf(shard->server, session->game.player.currentRoom) != shard->index;
+        }
+        start = newline + 1;
+    }
+
+    session->inputLength = (size_t)(end - start);
+    memmove(session->input, start, session->inputLength);
+
+    // The answer may only go out once the commands are durable. A session
+    // that moves on is committed by the shard it arrives at.
+    if (!moved && session->journaled && session->journal.dirty && !session->commitPending)
+    {
+        session->commitPending = 1;
+        session->nextCommit = shard->commitQueue;
+        shard->commitQueue = session;
+        shard->commitQueueLength++;
+    }
+    return moved;
+}
+
+// Group commit: one flush makes the commands of every waiting session
+// durable, then their output is released
+static void commitSessions(Shard *shard)
+{
+    if (!shard->commitQueue)
+        return;
+
+    Journal **journals = statsMalloc(sizeof(Journal *) * (size_t)shard->commitQueueLength);
+    int count = 0;
+    for (Session *session = shard->commitQueue; journals && session; session = session->nextCommit)
+        journals[count++] = &session->journal;
+    if (!journals || journalCommitGroup(journals, count) != 0)
+        perror("journal commit");
+    free(journals);
+    shard->commits++;
+
+    Session *session = shard->commitQueue;
+    shard->commitQueue = NULL;
+    shard->commitQueueLength = 0;
+    while (session)
+    {
+        Session *next = session->nextCommit;
+        session->commitPending = 0;
+        flushSession(shard, session);
+        session = next;
+    }
+}
+
+// Run what the session has buffered, then hand it off or show the answers
+static void resumeSession(Shard *shard, Session *session)
+{
+    if (handleInput(shard, session))
+        handOff(shard, session);
+    else if (!session->commitPending)
+        flushSession(shard, session);
+}
+
+// Take in the sessions other shards handed to this one
+static void receiveSessions(Shard *shard)
+{
+    Server *server = shard->server;
+    uint64_t count;
+    if (read(shard->wakeup, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("eventfd");
+    for (int from = 0; from < server->shardCount; from++)
+    {
+        Session *session;
+        SpscQueue *queue = &server->handoffs[from * server->shardCount + shard->index];
+        while ((session = spscPop(queue)))
+        {
+            if (attachSession(shard, session) != 0)
+            {
+                freeSession(shard, session);
+                continue;
+            }
+            if (!session->waitingOut)
+                resumeSession(shard, session);
+        }
+    }
+}
+
+static void acceptSessions(Shard *shard)
+{
+    Server *server = shard->server;
+    for (;;)
+    {
+        int fd = accept4(server->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("accept");
+            return;
+        }
+
+        Session *session = statsCalloc(1, sizeof(Session));
+        if (!session)
+        {
+            close(fd);
+            continue;
+        }
+        session->fd = fd;
+        sinkInit(&session->game.out, SINK_BUFFER, fd);
+        session->game.router = &shard->router;
+        if (initializeGame(&session->game, &shard->dungeon) != 0 || attachSession(shard, session) != 0)
+        {
+            freeResources(&session->game);
+            sinkFree(&session->game.out);
+            free(session);
+            close(fd);
+            continue;
+        }
+
+        int sessions = __atomic_add_fetch(&server->sessionCount, 1, __ATOMIC_RELAXED);
+        server->sessionsServed++;
+        if (sessions > server->peakSessions)
+            server->peakSessions = sessions;
+
+        sinkPrintf(&session->game.out, "\n> ");
+        flushSession(shard, session);
+    }
+}
+
+static void serveSession(Shard *shard, Session *session, uint32_t events)
+{
+    if (events & EPOLLOUT)
+    {
+        if (flushSession(shard, session) != 0 || session->waitingOut)
+            return;
+        // Output drained: catch up on lines that arrived in the meantime
+        resumeSession(shard, session);
+        return;
+    }
+
+    if (events & (EPOLLERR | EPOLLHUP) && !(events & EPOLLIN))
+    {
+        closeSession(shard, session);
+        return;
+    }
+
+    for (;;)
+    {
+        size_t space = SESSION_INPUT_SIZE - 1 - session->inputLength;
+        ssize_t n = read(session->fd, session->input + session->inputLength, space);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0)
+        {
+            closeSession(shard, session);
+            return;
+        }
+        session->inputLength += (size_t)n;
+        if (handleInput(shard, session))
+        {
+            handOff(shard, session);
+            return;
+        }
+        if (session->closing || (size_t)n < space)
+            break;
+    }
+    if (!session->commitPending)
+        flushSession(shard, session);
+}
+
+static void *shardMain(void *argument)
+{
+    Shard *shard = argument;
+    Server *server = shard->server;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!__atomic_load_n(&server->stopping, __ATOMIC_ACQUIRE))
+    {
+        // Blocked handoffs are retried every millisecond
+        int count = epoll_wait(shard->epoll, events, SERVER_MAX_EVENTS, shard->blocked ? 1 : -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.ptr == NULL)
+                acceptSessions(shard);
+            else if (events[i].data.ptr == &shard->wakeup)
+                receiveSessions(shard);
+            else
+                serveSession(shard, events[i].data.ptr, events[i].events);
+        }
+        commitSessions(shard);
+        if (shard->blocked)
+            retryHandoffs(shard);
+    }
+    return NULL;
+}
+
+static int listenOn(const char *path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path %s is too long.\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static int openShard(Server *server, Shard *shard, int index, const char *dungeonPath)
+{
+    memset(shard, 0, sizeof(*shard));
+    shard->server = server;
+    shard->index = index;
+    shard->epoll = -1;
+    shard->wakeup = -1;
+    if (loadRooms(&shard->dungeon, dungeonPath) != 0)
+        return -1;
+    routerInit(&shard->router, &shard->dungeon);
+    shard->epoll = epoll_create1(EPOLL_CLOEXEC);
+    shard->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shard->epoll < 0 || shard->wakeup < 0)
+        return -1;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &shard->wakeup;
+    return epoll_ctl(shard->epoll, EPOLL_CTL_ADD, shard->wakeup, &event);
+}
+
+// Release a shard opened with openShard, after its thread has stopped
+static void closeShard(Shard *shard)
+{
+    while (shard->sessions)
+        closeSession(shard, shard->sessions);
+    while (shard->blocked)
+    {
+        Session *session = shard->blocked;
+        shard->blocked = session->nextBlocked;
+        freeSession(shard, session);
+    }
+    if (shard->epoll >= 0)
+        close(shard->epoll);
+    if (shard->wakeup >= 0)
+        close(shard->wakeup);
+    routerFree(&shard->router);
+    if (shard->dungeon.header)
+        dungeonClose(&shard->dungeon);
+}
+
+int serverMain(int argc, char **argv)
+{
+    const char *dungeonPath = dungeonDefaultPath();
+    const char *journalDir = NULL;
+    long shardCount = sysconf(_SC_NPROCESSORS_ONLN);
+    int first = 1;
+    while (first + 1 < argc && argv[first][0] == '-')
+    {
+        if (strcmp(argv[first], "-d") == 0)
+            dungeonPath = argv[first + 1];
+        else if (strcmp(argv[first], "-j") == 0)
+            journalDir = argv[first + 1];
+        else if (strcmp(argv[first], "-s") == 0)
+            shardCount = atol(argv[first + 1]);
+        else
+            break;
+        first += 2;
+    }
+    if (first != argc - 1 || shardCount <= 0)
+    {
+        fprintf(stderr, "Usage: game --server [-d dungeon-file] [-j journal-dir] [-s shards] <socket-path>\n");
+        return 1;
+    }
+    const char *socketPath = argv[first];
+
+    // Every session is a descriptor, so allow as many as the system does
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    // The shards inherit the blocked signals, so only sigwait below sees
+    // SIGINT and SIGTERM
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.journalDir = journalDir;
+    pthread_mutex_init(&server.playersLock, NULL);
+
+    // Opening is O(1), so a first look tells the room count; no shard may
+    // be empty
+    Dungeon dungeon;
+    if (loadRooms(&dungeon, dungeonPath) != 0)
+        return 1;
+    server.roomCount = dungeon.roomCount;
+    int startRoom = dungeon.header->startRoom;
+    dungeonClose(&dungeon);
+    if (shardCount > server.roomCount)
+        shardCount = server.roomCount;
+    server.shardCount = (int)shardCount;
+    server.shards = statsMalloc(sizeof(Shard) * (size_t)server.shardCount);
+    server.handoffs = statsCalloc((size_t)server.shardCount * (size_t)server.shardCount, sizeof(SpscQueue));
+    int failed = !server.shards || !server.handoffs;
+    for (int i = 0; !failed && i < server.shardCount * server.shardCount; i++)
+        failed = spscInit(&server.handoffs[i], HANDOFF_QUEUE_SIZE) != 0;
+    int opened = 0;
+    while (!failed && opened < server.shardCount)
+    {
+        failed = openShard(&server, &server.shards[opened], opened, dungeonPath) != 0;
+        opened++;
+    }
+
+    // New players start in the start room, so its shard accepts them
+    server.listener = failed ? -1 : listenOn(socketPath);
+    if (server.listener >= 0)
+    {
+        Shard *entry = &server.shards[shardOf(&server, startRoom)];
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL; // The listener is the only entry without a session
+        failed = epoll_ctl(entry->epoll, EPOLL_CTL_ADD, server.listener, &event) != 0;
+    }
+
+    double cpuStart = cpuSeconds();
+    int started = 0;
+    if (!failed && server.listener >= 0)
+    {
+        printf("Listening on %s with %d shards\n", socketPath, server.shardCount);
+        fflush(stdout);
+        while (started < server.shardCount &&
+               pthread_create(&server.shards[started].thread, NULL, shardMain, &server.shards[started]) == 0)
+            started++;
+    }
+
+    if (started == server.shardCount)
+    {
+        int received;
+        sigwait(&stopSignals, &received);
+    }
+    __atomic_store_n(&server.stopping, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < started; i++)
+    {
+        uint64_t one = 1;
+        if (write(server.shards[i].wakeup, &one, sizeof(one)) < 0)
+            perror("eventfd");
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(server.shards[i].thread, NULL);
+    double cpu = cpuSeconds() - cpuStart;
+
+    // Sessions still in the queues belong to the shards they were sent to
+    long commands = 0, commits = 0, handoffs = 0;
+    size_t sessionBytes = 0, peakSessionBytes = 0;
+    unsigned long long hits = 0, misses = 0, evictions = 0;
+    size_t cacheBytes = 0;
+    int paged = 0;
+    for (int to = 0; to < opened; to++)
+    {
+        Shard *shard = &server.shards[to];
+        for (int from = 0; from < server.shardCount; from++)
+        {
+            Session *session;
+            while ((session = spscPop(&server.handoffs[from * server.shardCount + to])))
+                freeSession(shard, session);
+        }
+        RoomCache *cache = shard->dungeon.cache;
+        if (cache)
+        {
+            paged = 1;
+            hits += cache->hits;
+            misses += cache->misses;
+            evictions += cache->evictions;
+            cacheBytes += roomCacheBytes(cache);
+        }
+        closeShard(shard);
+        commands += shard->commands;
+        commits += shard->commits;
+        handoffs += shard->handoffs;
+        sessionBytes += shard->sessionBytes;
+        if (shard->peakSessionBytes > peakSessionBytes)
+            peakSessionBytes = shard->peakSessionBytes;
+    }
+    if (server.listener >= 0)
+    {
+        close(server.listener);
+        unlink(socketPath);
+    }
+    for (int i = 0; server.handoffs && i < server.shardCount * server.shardCount; i++)
+        spscFree(&server.handoffs[i]);
+    free(server.handoffs);
+    free(server.shards);
+    for (int i = 0; i < server.playerCount; i++)
+        free(server.players[i]);
+    free(server.players);
+    pthread_mutex_destroy(&server.playersLock);
+    if (started != server.shardCount)
+        return 1;
+
+    printf("Served %ld sessions (peak %d concurrent), %ld commands in %.2f CPU seconds",
+           server.sessionsServed, server.peakSessions, commands, cpu);
+    if (cpu > 0)
+        printf(" (%.0f commands per CPU second)", commands / cpu);
+    printf("\n");
+    printf("Shards: %d, %ld handoffs between them\n", server.shardCount, handoffs);
+    if (journalDir)
+        printf("Journal: %ld group commits for %ld commands\n", commits, commands);
+    if (server.sessionsServed > 0)
+        printf("Session memory: %zu bytes average, %zu bytes peak\n",
+               sessionBytes / (size_t)server.sessionsServed, peakSessionBytes);
+    if (paged)
+        printf("Room cache: %llu hits, %llu misses, %llu evictions, %zu bytes\n", hits, misses, evictions, cacheBytes);
+    STATS_EXIT();
+    return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// Multi-session game server.
+//
+// Usage: game --server [-d dungeon-file] [-j journal-dir] [-s shards] <socket-path>
+//
+// Listens on a Unix domain socket and hosts an independent game for every
+// connection. The rooms are split into contiguous ranges, one per shard (by
+// default one per online CPU), and every shard is a thread with its own
+// epoll loop serving the sessions whose players are in its rooms. A player
+// who walks into another shard's range is handed to that shard through a
+// lock-free single-producer single-consumer queue (spsc.h). Clients send one
+// command per line and receive the same text the terminal game prints,
+// ending with the "> " prompt. SIGINT or SIGTERM stop the server, which then
+// reports the sessions and commands it served and the CPU time it used.
+int serverMain(int argc, char **argv);
+
+#endif // SERVER_H
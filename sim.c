@@ -0,0 +1,397 @@
+// sim - Monte Carlo combat and balance simulator
+//
+// Usage: sim [options]
+//   -m fights|playthroughs   what one trial is (default fights)
+//   -n <trials>              number of trials (default 1000000)
+//   -t <threads>             worker threads, 0 = all cores (default 0)
+//   -s <seed>                random seed (default 1)
+//   -d <dungeon-file>        dungeon for playthroughs (default dungeon.dat)
+//   --health <min:max>       player starting health (default 100:100)
+//   --strength <min:max>     player strength (default 15:35)
+//   --creature <min:max>     creature health in fights (default 20:400)
+//   --damage <min:max>       creature damage per round (default 5:5)
+//   --scale <min:max>        percent applied to dungeon creature health in
+//                            playthroughs (default 100:100)
+//
+// A fight pits a random player against a random creature using the same
+// rules as attack(), and fights are resolved in batches by the vectorized
+// combat kernel. A playthrough fights every creature of the dungeon in
+// room order with the player's health carried over, stopping at the first
+// loss. Trials are split recursively over a work-stealing thread pool; every
+// block of trials has its own random stream, so results only depend on the
+// seed, never on the number of threads.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "dungeon.h"
+#include "combat.h"
+#include "threadpool.h"
+
+#define BLOCK_TRIALS 16384 // Trials per leaf task
+#define FIGHT_BATCH 1024   // Fights resolved per call of the combat kernel
+#define HEALTH_BUCKETS 10  // Histogram of remaining health, in tenths
+#define CREATURE_BUCKETS 20
+#define MAX_STAGES 64      // Creatures tracked per playthrough
+
+typedef struct Range
+{
+    int min, max;
+} Range;
+
+typedef struct Config
+{
+    int playthroughs;
+    long trials;
+    uint64_t seed;
+    Range health, strength, creature, damage, scale;
+    int stageHealth[MAX_STAGES]; // Creature health of each playthrough stage
+    const char *stageName[MAX_STAGES];
+    int stageCount;
+} Config;
+
+// Results of one block of trials, merged once all blocks are done
+typedef struct Tally
+{
+    long trials;
+    long wins;
+    long healthLeft[HEALTH_BUCKETS + 1]; // Winners by remaining health, last bucket is full health
+    long bucketTrials[CREATURE_BUCKETS]; // Fights by creature health
+    long bucketWins[CREATURE_BUCKETS];
+    long stageReached[MAX_STAGES];
+    long stageWon[MAX_STAGES];
+    long rounds;
+} Tally;
+
+typedef struct Job
+{
+    const Config *config;
+    Tally *tallies; // One per block
+    ThreadPool *pool;
+} Job;
+
+typedef struct Split
+{
+    Job *job;
+    long firstBlock;
+    long blockCount;
+} Split;
+
+// splitmix64, one independent stream per block
+static uint64_t nextRandom(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static int sample(uint64_t *state, Range range)
+{
+    return range.min + (int)(nextRandom(state) % (uint64_t)(range.max - range.min + 1));
+}
+
+static void recordHealth(Tally *tally, int health, int startHealth)
+{
+    int bucket = startHealth > 0 ? (int)((long)health * HEALTH_BUCKETS / startHealth) : 0;
+    if (bucket > HEALTH_BUCKETS)
+        bucket = HEALTH_BUCKETS;
+    tally->healthLeft[bucket]++;
+}
+
+// Fights are drawn into arrays and resolved FIGHT_BATCH at a time by the
+// vectorized combat kernel, then tallied
+static void runFights(const Config *config, uint64_t *random, long count, Tally *tally)
+{
+    int32_t health[FIGHT_BATCH], strength[FIGHT_BATCH], creature[FIGHT_BATCH], damage[FIGHT_BATCH];
+    int32_t startHealth[FIGHT_BATCH], startCreature[FIGHT_BATCH], rounds[FIGHT_BATCH], won[FIGHT_BATCH];
+    for (long done = 0; done < count; done += FIGHT_BATCH)
+    {
+        uint32_t n = count - done < FIGHT_BATCH ? (uint32_t)(count - done) : FIGHT_BATCH;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            health[i] = startHealth[i] = sample(random, config->health);
+            strength[i] = sample(random, config->strength);
+            creature[i] = startCreature[i] = sample(random, config->creature);
+            damage[i] = sample(random, config->damage);
+        }
+        CombatBatch batch = {health, strength, creature, damage, rounds, won, n};
+        combatResolveBatch(&batch);
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            int bucket = (int)((long)(startCreature[i] - config->creature.min) * CREATURE_BUCKETS /
+                               (config->creature.max - config->creature.min + 1));
+            tally->trials++;
+            tally->bucketTrials[bucket]++;
+            tally->rounds += rounds[i];
+            if (won[i])
+            {
+                tally->wins++;
+                tally->bucketWins[bucket]++;
+                recordHealth(tally, health[i], startHealth[i]);
+            }
+        }
+    }
+}
+
+static void runBlock(const Config *config, long block, Tally *tally)
+{
+    uint64_t random = config->seed ^ ((uint64_t)block * 0xd1342543de82ef95ull);
+    long first = block * BLOCK_TRIALS;
+    long count = config->trials - first < BLOCK_TRIALS ? config->trials - first : BLOCK_TRIALS;
+    if (!config->playthroughs)
+    {
+        runFights(config, &random, count, tally);
+        return;
+    }
+
+    // Each stage of a playthrough depends on the one before, so these are
+    // resolved one fight at a time
+    for (long t = 0; t < count; t++)
+    {
+        int health = sample(&random, config->health);
+        int strength = sample(&random, config->strength);
+        tally->trials++;
+
+        int current = health;
+        int won = 1;
+        for (int s = 0; s < config->stageCount && won; s++)
+        {
+            int creature = (int)((long)config->stageHealth[s] * sample(&random, config->scale) / 100);
+            CombatResult result = combatResolve(current, strength, creature > 0 ? creature : 1,
+                                                sample(&random, config->damage));
+            tally->stageReached[s]++;
+            tally->rounds += result.rounds;
+            won = result.playerWon;
+            current = result.playerHealth;
+            if (won)
+                tally->stageWon[s]++;
+        }
+        if (won)
+        {
+            tally->wins++;
+            recordHealth(tally, current, health);
+        }
+    }
+}
+
+// Fork/join: keep splitting the block range in half, handing one half to
+// the pool where idle workers can steal it, until single blocks remain.
+static void runSplit(void *argument, int worker)
+{
+    (void)worker;
+    Split *split = argument;
+    while (split->blockCount > 1)
+    {
+        Split *half = malloc(sizeof(Split));
+        half->job = split->job;
+        half->blockCount = split->blockCount / 2;
+        half->firstBlock = split->firstBlock + split->blockCount - half->blockCount;
+        split->blockCount -= half->blockCount;
+        threadPoolSubmit(split->job->pool, runSplit, half);
+    }
+    if (split->blockCount == 1)
+        runBlock(split->job->config, split->firstBlock, &split->job->tallies[split->firstBlock]);
+    free(split);
+}
+
+static int parseRange(const char *text, Range *range)
+{
+    if (sscanf(text, "%d:%d", &range->min, &range->max) == 2)
+        return range->min <= range->max ? 0 : -1;
+    if (sscanf(text, "%d", &range->min) == 1)
+    {
+        range->max = range->min;
+        return 0;
+    }
+    return -1;
+}
+
+static void printBar(long count, long total)
+{
+    int width = total > 0 ? (int)(count * 40 / total) : 0;
+    for (int i = 0; i < width; i++)
+        putchar('#');
+    putchar('\n');
+}
+
+static int loadStages(Config *config, Dungeon *dungeon, const char *path)
+{
+    if (dungeonOpen(dungeon, path) != 0)
+        return -1;
+    for (int i = 0; i < dungeon->roomCount && config->stageCount < MAX_STAGES; i++)
+    {
+        const DungeonRoom *room = &dungeon->rooms[i];
+        if (room->creature == 0 || room->creatureHealth <= 0)
+            continue;
+        config->stageName[config->stageCount] = dungeonString(dungeon, room->creature);
+        config->stageHealth[config->stageCount] = room->creatureHealth;
+        config->stageCount++;
+    }
+    if (config->stageCount == 0)
+    {
+        fprintf(stderr, "%s has no creatures.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    Config config;
+    memset(&config, 0, sizeof(config));
+    config.trials = 1000000;
+    config.seed = 1;
+    config.health = (Range){100, 100};
+    config.strength = (Range){15, 35};
+    config.creature = (Range){20, 400};
+    config.damage = (Range){CREATURE_DAMAGE, CREATURE_DAMAGE};
+    config.scale = (Range){100, 100};
+    const char *dungeonPath = DEFAULT_DUNGEON;
+    int threads = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        int ok = value != NULL;
+        if (ok && strcmp(argv[i], "-m") == 0)
+        {
+            config.playthroughs = strcmp(value, "playthroughs") == 0;
+            ok = config.playthroughs || strcmp(value, "fights") == 0;
+        }
+        else if (ok && strcmp(argv[i], "-n") == 0)
+            ok = (config.trials = atol(value)) > 0;
+        else if (ok && strcmp(argv[i], "-t") == 0)
+            threads = atoi(value);
+        else if (ok && strcmp(argv[i], "-s") == 0)
+            config.seed = strtoull(value, NULL, 10);
+        else if (ok && strcmp(argv[i], "-d") == 0)
+            dungeonPath = value;
+        else if (ok && strcmp(argv[i], "--health") == 0)
+            ok = parseRange(value, &config.health) == 0;
+        else if (ok && strcmp(argv[i], "--strength") == 0)
+            ok = parseRange(value, &config.strength) == 0 && config.strength.min > 0;
+        else if (ok && strcmp(argv[i], "--creature") == 0)
+            ok = parseRange(value, &config.creature) == 0 && config.creature.min > 0;
+        else if (ok && strcmp(argv[i], "--damage") == 0)
+            ok = parseRange(value, &config.damage) == 0 && config.damage.min >= 0;
+        else if (ok && strcmp(argv[i], "--scale") == 0)
+            ok = parseRange(value, &config.scale) == 0 && config.scale.min > 0;
+        else
+            ok = 0;
+        if (!ok)
+        {
+            fprintf(stderr, "Invalid option %s, see the top of sim.c for usage.\n", argv[i]);
+            return 1;
+        }
+        i++;
+    }
+
+    // The batched combat kernel is exact below its limit
+    if (config.health.max >= COMBAT_BATCH_LIMIT || config.strength.max >= COMBAT_BATCH_LIMIT ||
+        config.creature.max >= COMBAT_BATCH_LIMIT || config.damage.max >= COMBAT_BATCH_LIMIT)
+    {
+        fprintf(stderr, "Health, strength and damage must stay below %d.\n", COMBAT_BATCH_LIMIT);
+        return 1;
+    }
+
+    Dungeon dungeon;
+    memset(&dungeon, 0, sizeof(dungeon));
+    if (config.playthroughs && loadStages(&config, &dungeon, dungeonPath) != 0)
+        return 1;
+
+    long blocks = (config.trials + BLOCK_TRIALS - 1) / BLOCK_TRIALS;
+    Job job;
+    job.config = &config;
+    job.tallies = calloc((size_t)blocks, sizeof(Tally));
+    job.pool = threadPoolCreate(threads);
+    if (!job.tallies || !job.pool)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Split *root = malloc(sizeof(Split));
+    root->job = &job;
+    root->firstBlock = 0;
+    root->blockCount = blocks;
+    threadPoolSubmit(job.pool, runSplit, root);
+    threadPoolWait(job.pool);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    Tally total;
+    memset(&total, 0, sizeof(total));
+    for (long b = 0; b < blocks; b++)
+    {
+        const Tally *t = &job.tallies[b];
+        total.trials += t->trials;
+        total.wins += t->wins;
+        total.rounds += t->rounds;
+        for (int i = 0; i <= HEALTH_BUCKETS; i++)
+            total.healthLeft[i] += t->healthLeft[i];
+        for (int i = 0; i < CREATURE_BUCKETS; i++)
+        {
+            total.bucketTrials[i] += t->bucketTrials[i];
+            total.bucketWins[i] += t->bucketWins[i];
+        }
+        for (int i = 0; i < MAX_STAGES; i++)
+        {
+            total.stageReached[i] += t->stageReached[i];
+            total.stageWon[i] += t->stageWon[i];
+        }
+    }
+
+    printf("%ld %s on %d threads in %.3f s (%.0f trials/sec, %.0f rounds/sec)\n",
+           total.trials, config.playthroughs ? "playthroughs" : "fights",
+           threadPoolSize(job.pool), elapsed, total.trials / elapsed, total.rounds / elapsed);
+    printf("Win rate: %.2f%%\n", 100.0 * total.wins / total.trials);
+
+    if (config.playthroughs)
+    {
+        printf("\nStage                 reached      won  win rate\n");
+        for (int s = 0; s < config.stageCount; s++)
+        {
+            long reached = total.stageReached[s];
+            printf("%-18s %10ld %8ld  %6.2f%%\n", config.stageName[s], reached, total.stageWon[s],
+                   reached ? 100.0 * total.stageWon[s] / reached : 0.0);
+        }
+    }
+    else
+    {
+        printf("\nCreature health     fights  win rate\n");
+        int span = config.creature.max - config.creature.min + 1;
+        for (int i = 0; i < CREATURE_BUCKETS; i++)
+        {
+            if (total.bucketTrials[i] == 0)
+                continue;
+            int low = config.creature.min + (int)((long)span * i / CREATURE_BUCKETS);
+            int high = config.creature.min + (int)((long)span * (i + 1) / CREATURE_BUCKETS) - 1;
+            double rate = 100.0 * total.bucketWins[i] / total.bucketTrials[i];
+            printf("%5d-%-5d  %12ld  %6.2f%%  ", low, high, total.bucketTrials[i], rate);
+            printBar((long)(rate * 10), 1000);
+        }
+    }
+
+    printf("\nHealth left (winners)\n");
+    for (int i = 0; i <= HEALTH_BUCKETS; i++)
+    {
+        if (i < HEALTH_BUCKETS)
+            printf("%3d-%3d%%  %10ld  ", i * 100 / HEALTH_BUCKETS, (i + 1) * 100 / HEALTH_BUCKETS - 1,
+                   total.healthLeft[i]);
+        else
+            printf("   100%%  %10ld  ", total.healthLeft[i]);
+        printBar(total.healthLeft[i], total.wins);
+    }
+
+    threadPoolDestroy(job.pool);
+    free(job.tallies);
+    if (config.playthroughs)
+        dungeonClose(&dungeon);
+    return 0;
+}
@@ -0,0 +1,566 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "stats.h"
+
+#define MAX_INVENTORY_CAPACITY 65536
+
+// CRC table, built once: the server's shards checksum journals and
+// snapshots on several threads at once
+static uint32_t crcTable[256];
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void buildCrcTable(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crcTable[i] = c;
+    }
+}
+
+uint32_t checksum32(const void *data, size_t size)
+{
+    pthread_once(&crcOnce, buildCrcTable);
+    const unsigned char *p = data;
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < size; i++)
+        crc = crcTable[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+uint32_t snapshotDungeonId(const Dungeon *dungeon)
+{
+    return checksum32(dungeon->header, sizeof(DungeonHeader));
+}
+
+static size_t padded(size_t length)
+{
+    return (length + 7) & ~(size_t)7;
+}
+
+// Write a whole buffer, returns the bytes written
+static size_t writeAll(int fd, const unsigned char *buffer, size_t size)
+{
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t n = write(fd, buffer + written, size - written);
+        if (n <= 0)
+            break;
+        written += (size_t)n;
+    }
+    return written;
+}
+
+// Append a section header and payload at *offset
+static void putSection(unsigned char *buffer, size_t *offset, uint32_t tag, const void *payload, size_t length)
+{
+    SnapshotSection section;
+    memset(&section, 0, sizeof(section));
+    section.tag = tag;
+    section.length = (uint32_t)length;
+    section.crc = checksum32(payload, length);
+    memcpy(buffer + *offset, &section, sizeof(section));
+    *offset += sizeof(section);
+    if (length > 0)
+        memcpy(buffer + *offset, payload, length);
+    memset(buffer + *offset + length, 0, padded(length) - length);
+    *offset += padded(length);
+}
+
+static int roomChanged(const RoomTable *rooms, uint32_t slot)
+{
+    return rooms->keys[slot] != 0 &&
+           (rooms->states[slot].creatureDamage != 0 || rooms->states[slot].itemsTaken != 0);
+}
+
+// Rooms a snapshot records: every changed room, or for a delta only those
+// changed since the last save
+static int roomIncluded(const RoomTable *rooms, uint32_t slot, int delta)
+{
+    if (delta)
+        return rooms->keys[slot] != 0 && rooms->states[slot].dirty;
+    return roomChanged(rooms, slot);
+}
+
+// Checksums of the player and inventory sections together, to tell whether
+// a delta needs them
+static uint64_t playerChecksum(const SnapshotPlayer *p, const uint16_t *items, size_t inventoryBytes)
+{
+    return (uint64_t)checksum32(p, sizeof(*p)) << 32 | checksum32(items, inventoryBytes);
+}
+
+// Serialize a full snapshot or, with delta set, what changed since the
+// session's last save. *playerSum receives the player checksum.
+static int encode(const GameState *game, int delta, unsigned char **buffer, size_t *size, uint64_t *playerSum)
+{
+    const Dungeon *dungeon = game->dungeon;
+    const Player *player = &game->player;
+    const RoomTable *rooms = &game->rooms;
+
+    size_t includedRooms = 0;
+    for (uint32_t i = 0; i < rooms->capacity; i++)
+        includedRooms += roomIncluded(rooms, i, delta);
+
+    size_t inventoryBytes = sizeof(uint16_t) * (size_t)player->inventoryCount;
+    size_t roomBytes = sizeof(SnapshotRoom) * includedRooms;
+    if (roomBytes > UINT32_MAX)
+        return -1;
+    uint16_t *items = statsMalloc(inventoryBytes + 1);
+    SnapshotRoom *changed = statsMalloc(roomBytes + 1);
+    if (!items || !changed)
+    {
+        free(items);
+        free(changed);
+        return -1;
+    }
+
+    SnapshotPlayer p;
+    p.health = player->health;
+    p.strength = player->strength;
+    p.inventoryCapacity = player->inventoryCapacity;
+    p.inventoryCount = player->inventoryCount;
+    p.currentRoom = player->currentRoom;
+    p.options = game->briefFights ? SNAPSHOT_BRIEF_FIGHTS : 0;
+    memset(p.reserved, 0, sizeof(p.reserved));
+
+    // Item ids are only meaningful inside this process, the file stores the
+    // dungeon's own item indices.
+    int count = 0;
+    for (ItemId id = itemSetNext(&player->inventory, 0); id != ITEM_NONE && count < player->inventoryCount;
+         id = itemSetNext(&player->inventory, id + 1))
+        items[count++] = (uint16_t)dungeonFindItem(dungeon, itemName(id));
+
+    // A delta leaves the player and inventory out unless one of them changed
+    uint64_t sum = playerChecksum(&p, items, inventoryBytes);
+    int withPlayer = !delta || sum != game->saved.playerSum;
+    size_t total = sizeof(SnapshotHeader) + sizeof(SnapshotSection) + padded(roomBytes);
+    if (withPlayer)
+        total += sizeof(SnapshotSection) + padded(sizeof(SnapshotPlayer)) +
+                 sizeof(SnapshotSection) + padded(inventoryBytes);
+
+    // The whole snapshot is assembled in one buffer so it can be written
+    // with a single write.
+    unsigned char *out = statsMalloc(total);
+    if (!out)
+    {
+        free(items);
+        free(changed);
+        return -1;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = delta ? SNAPSHOT_DELTA_MAGIC : SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.dungeonId = snapshotDungeonId(dungeon);
+    header.sectionCount = withPlayer ? 3 : 1;
+    header.size = total;
+    memcpy(out, &header, sizeof(header));
+    size_t offset = sizeof(header);
+
+    if (withPlayer)
+    {
+        putSection(out, &offset, SNAPSHOT_PLAYER, &p, sizeof(p));
+        putSection(out, &offset, SNAPSHOT_INVENTORY, items, inventoryBytes);
+    }
+
+    size_t n = 0;
+    for (uint32_t i = 0; i < rooms->capacity; i++)
+    {
+        if (roomIncluded(rooms, i, delta))
+        {
+            changed[n].room = (uint32_t)roomTableRoom(rooms, i);
+            changed[n].creatureDamage = rooms->states[i].creatureDamage;
+            changed[n].itemsTaken = rooms->states[i].itemsTaken;
+            n++;
+        }
+    }
+    putSection(out, &offset, SNAPSHOT_ROOMS, changed, roomBytes);
+
+    free(items);
+    free(changed);
+    *buffer = out;
+    *size = total;
+    *playerSum = sum;
+    return 0;
+}
+
+int snapshotEncode(const GameState *game, unsigned char **buffer, size_t *size)
+{
+    uint64_t playerSum;
+    return encode(game, 0, buffer, size, &playerSum);
+}
+
+// Locate a section and check its bounds and checksum
+static const unsigned char *findSection(const unsigned char *buffer, size_t size, uint32_t tag, uint32_t *length)
+{
+    size_t offset = sizeof(SnapshotHeader);
+    while (size - offset >= sizeof(SnapshotSection))
+    {
+        SnapshotSection section;
+        memcpy(&section, buffer + offset, sizeof(section));
+        offset += sizeof(section);
+        if (padded(section.length) > size - offset)
+            return NULL;
+        if (section.tag == tag)
+        {
+            if (checksum32(buffer + offset, section.length) != section.crc)
+                return NULL;
+            *length = section.length;
+            return buffer + offset;
+        }
+        offset += padded(section.length);
+    }
+    return NULL;
+}
+
+// One snapshot or delta, validated against the dungeon
+typedef struct Block
+{
+    uint64_t size;
+    int hasPlayer; // Deltas may leave the player and inventory out
+    SnapshotPlayer player;
+    const unsigned char *inventory;
+    uint32_t inventoryBytes;
+    const unsigned char *rooms;
+    uint32_t roomBytes;
+} Block;
+
+static int checkPlayer(const Dungeon *dungeon, const Block *block)
+{
+    const SnapshotPlayer *p = &block->player;
+    if (p->currentRoom < 0 || p->currentRoom >= dungeon->roomCount ||
+        p->inventoryCapacity < 0 || p->inventoryCapacity > MAX_INVENTORY_CAPACITY ||
+        p->inventoryCount < 0 || p->inventoryCount > p->inventoryCapacity ||
+        block->inventoryBytes != sizeof(uint16_t) * (size_t)p->inventoryCount)
+        return -1;
+
+    for (int i = 0; i < p->inventoryCount; i++)
+    {
+        uint16_t item;
+        memcpy(&item, block->inventory + sizeof(item) * i, sizeof(item));
+        if (item >= dungeon->itemCount)
+            return -1;
+    }
+    return 0;
+}
+
+static int checkRooms(const Dungeon *dungeon, const Block *block)
+{
+    if (block->roomBytes % sizeof(SnapshotRoom) != 0)
+        return -1;
+    size_t roomCount = block->roomBytes / sizeof(SnapshotRoom);
+    for (size_t i = 0; i < roomCount; i++)
+    {
+        SnapshotRoom r;
+        memcpy(&r, block->rooms + sizeof(r) * i, sizeof(r));
+        if (r.room >= (uint32_t)dungeon->roomCount)
+            return -1;
+        int itemCount = dungeonRoomItemCount(dungeonRoom(dungeon, (int)r.room));
+        if (itemCount < DUNGEON_MAX_ROOM_ITEMS && (r.itemsTaken >> itemCount) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Parse the block at the start of buffer, a snapshot or a delta depending
+// on magic. Returns 0 if it is complete and valid.
+static int readBlock(const Dungeon *dungeon, const unsigned char *buffer, size_t size, uint32_t magic, Block *block)
+{
+    SnapshotHeader header;
+    if (size < sizeof(header))
+        return -1;
+    memcpy(&header, buffer, sizeof(header));
+    int versionKnown = header.version == SNAPSHOT_VERSION ||
+                       (magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION_NO_DELTAS);
+    if (header.magic != magic || !versionKnown || header.dungeonId != snapshotDungeonId(dungeon) ||
+        header.size < sizeof(header) || header.size > size)
+        return -1;
+
+    memset(block, 0, sizeof(*block));
+    block->size = header.size;
+    block->hasPlayer = header.sectionCount == 3;
+    block->rooms = findSection(buffer, header.size, SNAPSHOT_ROOMS, &block->roomBytes);
+    if (!block->rooms || (magic == SNAPSHOT_MAGIC && !block->hasPlayer))
+        return -1;
+    if (block->hasPlayer)
+    {
+        uint32_t playerBytes;
+        const unsigned char *playerData = findSection(buffer, header.size, SNAPSHOT_PLAYER, &playerBytes);
+        block->inventory = findSection(buffer, header.size, SNAPSHOT_INVENTORY, &block->inventoryBytes);
+        if (!playerData || !block->inventory || playerBytes != sizeof(SnapshotPlayer))
+            return -1;
+        memcpy(&block->player, playerData, sizeof(block->player));
+        if (checkPlayer(dungeon, block) != 0)
+            return -1;
+    }
+    return checkRooms(dungeon, block);
+}
+
+static int readInventory(const Dungeon *dungeon, const Block *block, ItemSet *inventory)
+{
+    itemSetClear(inventory);
+    for (int i = 0; i < block->player.inventoryCount; i++)
+    {
+        uint16_t item;
+        memcpy(&item, block->inventory + sizeof(item) * i, sizeof(item));
+        ItemId id = dungeon->itemIds[item];
+        if (itemSetHas(inventory, id) || itemSetAdd(inventory, id) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int readRooms(const Block *block, RoomTable *states)
+{
+    size_t roomCount = block->roomBytes / sizeof(SnapshotRoom);
+    for (size_t i = 0; i < roomCount; i++)
+    {
+        SnapshotRoom r;
+        memcpy(&r, block->rooms + sizeof(r) * i, sizeof(r));
+        RoomState *state = roomTableGet(states, (int)r.room);
+        if (!state)
+            return -1;
+        state->creatureDamage = r.creatureDamage;
+        state->itemsTaken = r.itemsTaken;
+    }
+    return 0;
+}
+
+int snapshotDecode(GameState *game, const unsigned char *buffer, size_t size)
+{
+    const Dungeon *dungeon = game->dungeon;
+    Player *player = &game->player;
+
+    // Validate the base before touching the game state
+    Block block;
+    if (readBlock(dungeon, buffer, size, SNAPSHOT_MAGIC, &block) != 0)
+        return -1;
+
+    // Build the new state on the side, in an arena of its own, so a failure
+    // leaves the game intact and success simply swaps the arenas
+    Arena arena;
+    arenaInit(&arena, SESSION_ARENA_BLOCK);
+    RoomTable states;
+    roomTableInit(&states, &arena);
+    ItemSet inventory;
+    if (itemSetInit(&inventory, itemCount()) != 0)
+        return -1;
+
+    // Deltas follow the base and are applied in order. A torn or damaged
+    // delta ends the file: it is where an interrupted save stopped.
+    SnapshotPlayer p = block.player;
+    int failed = readInventory(dungeon, &block, &inventory) != 0 || readRooms(&block, &states) != 0;
+    for (size_t offset = block.size; !failed &&
+         readBlock(dungeon, buffer + offset, size - offset, SNAPSHOT_DELTA_MAGIC, &block) == 0;
+         offset += block.size)
+    {
+        if (block.hasPlayer)
+        {
+            p = block.player;
+            failed = readInventory(dungeon, &block, &inventory) != 0;
+        }
+        failed = failed || readRooms(&block, &states) != 0;
+    }
+    if (failed)
+    {
+        arenaFree(&arena);
+        itemSetFree(&inventory);
+        return -1;
+    }
+
+    arenaFree(&game->arena);
+    game->arena = arena;
+    game->rooms = states;
+    game->rooms.arena = &game->arena;
+    roomViewsInit(&game->views, &game->arena);
+    itemSetFree(&player->inventory);
+    player->inventory = inventory;
+    player->health = p.health;
+    player->strength = p.strength;
+    player->inventoryCapacity = p.inventoryCapacity;
+    player->inventoryCount = p.inventoryCount;
+    player->currentRoom = p.currentRoom;
+    game->briefFights = (p.options & SNAPSHOT_BRIEF_FIGHTS) != 0;
+    snapshotForgetSave(game);
+    return 0;
+}
+
+int snapshotTemporaryFile(const char *path, char **temporary)
+{
+    size_t pathLength = strlen(path);
+    *temporary = statsMalloc(pathLength + 8);
+    if (!*temporary)
+        return -1;
+    memcpy(*temporary, path, pathLength);
+    memcpy(*temporary + pathLength, ".XXXXXX", 8);
+
+    int fd = mkstemp(*temporary);
+    if (fd < 0 || fchmod(fd, 0644) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(*temporary);
+        }
+        free(*temporary);
+        *temporary = NULL;
+        return -1;
+    }
+    return fd;
+}
+
+// Write a file next to the target and rename it, so a failed save never
+// destroys the previous one
+static int replaceFile(const char *path, const unsigned char *buffer, size_t size)
+{
+    char *temporary;
+    int fd = snapshotTemporaryFile(path, &temporary);
+    if (fd < 0)
+        return -1;
+
+    int result = -1;
+    size_t written = writeAll(fd, buffer, size);
+    if (close(fd) == 0 && written == size && rename(temporary, path) == 0)
+        result = 0;
+    else
+        unlink(temporary);
+
+    free(temporary);
+    return result;
+}
+
+// Append a delta to the file the session saved to last. Returns -1 if the
+// file is no longer as that save left it.
+static int appendFile(const char *path, uint64_t expectedSize, const unsigned char *buffer, size_t size)
+{
+    int fd = open(path, O_WRONLY | O_APPEND);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != expectedSize)
+    {
+        close(fd);
+        return -1;
+    }
+    size_t written = writeAll(fd, buffer, size);
+    if (written != size && ftruncate(fd, (off_t)expectedSize) != 0)
+        written = 0;
+    if (close(fd) != 0 || written != size)
+        return -1;
+    return 0;
+}
+
+int snapshotSave(const char *path, const GameState *game)
+{
+    unsigned char *buffer;
+    size_t size;
+    if (snapshotEncode(game, &buffer, &size) != 0)
+        return -1;
+    int result = replaceFile(path, buffer, size);
+    free(buffer);
+    return result;
+}
+
+int snapshotSaveIncremental(const char *path, GameState *game)
+{
+    SaveFile *saved = &game->saved;
+    int sameFile = saved->path && strcmp(saved->path, path) == 0;
+
+    // Compact once the deltas are many or outweigh the full snapshot
+    int delta = sameFile && saved->deltas < SNAPSHOT_MAX_DELTAS && saved->size - saved->baseSize <= saved->baseSize;
+    unsigned char *buffer;
+    size_t size;
+    uint64_t playerSum;
+    int result = -1;
+    if (delta && encode(game, 1, &buffer, &size, &playerSum) == 0)
+    {
+        result = appendFile(path, saved->size, buffer, size);
+        free(buffer);
+    }
+    if (result != 0)
+    {
+        delta = 0;
+        if (encode(game, 0, &buffer, &size, &playerSum) != 0)
+            return -1;
+        result = replaceFile(path, buffer, size);
+        free(buffer);
+    }
+    if (result != 0)
+        return -1;
+
+    if (!sameFile)
+    {
+        char *copy = statsStrdup(path);
+        if (!copy)
+        {
+            snapshotForgetSave(game);
+            return 0;
+        }
+        free(saved->path);
+        saved->path = copy;
+    }
+    saved->size = delta ? saved->size + size : size;
+    saved->baseSize = delta ? saved->baseSize : size;
+    saved->deltas = delta ? saved->deltas + 1 : 0;
+    saved->playerSum = playerSum;
+
+    RoomTable *rooms = &game->rooms;
+    for (uint32_t i = 0; i < rooms->capacity; i++)
+        rooms->states[i].dirty = 0;
+    return 0;
+}
+
+void snapshotForgetSave(GameState *game)
+{
+    free(game->saved.path);
+    memset(&game->saved, 0, sizeof(game->saved));
+}
+
+int snapshotLoad(const char *path, GameState *game)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    unsigned char *buffer = statsMalloc(size + 1);
+    if (!buffer)
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t got = 0;
+    while (got < size)
+    {
+        ssize_t n = read(fd, buffer + got, size - got);
+        if (n <= 0)
+            break;
+        got += (size_t)n;
+    }
+    close(fd);
+
+    int result = -1;
+    if (got == size)
+        result = snapshotDecode(game, buffer, size) == 0 ? 0 : -2;
+    free(buffer);
+    return result;
+}
@@ -0,0 +1,112 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hwdec12.h"
+
+// Binary save file. A fixed header is followed by length-prefixed sections,
+// each carrying its own CRC-32 and padded to 8 bytes:
+//
+//   SnapshotHeader
+//   SnapshotSection + SnapshotPlayer
+//   SnapshotSection + uint16_t inventory[inventoryCount]  (item indices)
+//   SnapshotSection + SnapshotRoom rooms[]                (changed rooms only)
+//
+// A snapshot records which dungeon it belongs to and is rejected when loaded
+// into a different one. Saving and loading each take a single write/read.
+//
+// Saving again to the file a session saved to last appends a delta instead:
+// a block laid out like a snapshot, with SNAPSHOT_DELTA_MAGIC, holding only
+// the rooms changed since that save and the player and inventory if either
+// of them changed. Loading applies the deltas in order on top of the full
+// snapshot and stops at a torn or damaged one. After SNAPSHOT_MAX_DELTAS
+// deltas, or once they outweigh the full snapshot, the next save writes a
+// full snapshot again.
+
+#define SNAPSHOT_MAGIC 0x5641534eu       // "NSAV"
+#define SNAPSHOT_DELTA_MAGIC 0x544c444eu // "NDLT"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_VERSION_NO_DELTAS 2 // Same layout, still loaded
+#define SNAPSHOT_MAX_DELTAS 16
+
+enum SnapshotTag
+{
+    SNAPSHOT_PLAYER = 1,
+    SNAPSHOT_INVENTORY = 2,
+    SNAPSHOT_ROOMS = 3
+};
+
+typedef struct SnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dungeonId; // CRC-32 of the dungeon file header
+    uint32_t sectionCount;
+    uint64_t size; // Total size of the snapshot in bytes
+} SnapshotHeader;
+
+typedef struct SnapshotSection
+{
+    uint32_t tag;
+    uint32_t length; // Payload bytes, not counting padding
+    uint32_t crc;    // CRC-32 of the payload
+    uint32_t reserved;
+} SnapshotSection;
+
+enum SnapshotOptions
+{
+    SNAPSHOT_BRIEF_FIGHTS = 1 // Fights are told in one line
+};
+
+typedef struct SnapshotPlayer
+{
+    int32_t health;
+    int32_t strength;
+    int32_t inventoryCapacity;
+    int32_t inventoryCount;
+    int32_t currentRoom;
+    int32_t options;     // SnapshotOptions, how the session tells the game
+    int32_t reserved[4]; // Former player flags, kills are in the room states
+} SnapshotPlayer;
+
+typedef struct SnapshotRoom
+{
+    uint32_t room;
+    int32_t creatureDamage;
+    uint64_t itemsTaken;
+} SnapshotRoom;
+
+// CRC-32 (IEEE) of a buffer
+uint32_t checksum32(const void *data, size_t size);
+
+// Identify a dungeon so snapshots are not loaded into the wrong world
+uint32_t snapshotDungeonId(const Dungeon *dungeon);
+
+// Serialize a session into a malloc'd buffer. Returns 0 on success.
+int snapshotEncode(const GameState *game, unsigned char **buffer, size_t *size);
+
+// Validate a snapshot and, only if it is intact, replace the session's
+// state with it. Returns 0 on success, -1 if the snapshot is invalid.
+int snapshotDecode(GameState *game, const unsigned char *buffer, size_t size);
+
+// Encode and write a snapshot with a single write. Returns 0 on success.
+int snapshotSave(const char *path, const GameState *game);
+
+// Save to a file, appending a delta if the session saved there last and
+// writing a full snapshot otherwise. Returns 0 on success.
+int snapshotSaveIncremental(const char *path, GameState *game);
+
+// Create a uniquely named file next to path to write a snapshot into and
+// rename over it, so saves to the same path never share one. Returns its
+// descriptor and sets *temporary to its malloc'd name, or returns -1.
+int snapshotTemporaryFile(const char *path, char **temporary);
+
+// Make the session's next save a full one, after its state was replaced
+void snapshotForgetSave(GameState *game);
+
+// Read a snapshot with a single read and decode it. Returns 0 on success,
+// -1 if the file cannot be read and -2 if it is not a valid snapshot.
+int snapshotLoad(const char *path, GameState *game);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,503 @@
+// solve - prove that a dungeon can be won and find the shortest way
+//
+// Usage: solve [-t threads] [-o log-file] [dungeon-file]
+//
+// Explores every game state reachable from the start: the player's room,
+// health and strength and which gate requirements are met (items carried,
+// creatures killed). Only what can change the outcome is part of a state:
+// items no gate needs and creatures no gate or goal needs are never worth
+// a command, so the solver ignores them. States are expanded breadth first,
+// one level per command, with every level split over a work-stealing
+// thread pool and a lock-free set of 64-bit state fingerprints shared by all
+// workers. The first level that defeats the goal creature gives a shortest
+// winning command sequence; if the levels run out, the dungeon cannot be
+// won.
+//
+// The sequence is printed and, with -o, written as a command log that
+// "game --replay" can play back. Exits 0 if the dungeon can be won, 2 if it
+// cannot and 1 on errors.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "hwdec12.h"
+#include "combat.h"
+#include "threadpool.h"
+
+#define CHUNK_STATES 1024 // States expanded per leaf task
+#define NO_BIT -1
+
+enum SolverCommand
+{
+    COMMAND_MOVE,   // Argument is the direction
+    COMMAND_PICKUP, // Argument is the dungeon item index
+    COMMAND_ATTACK
+};
+
+typedef struct SolverState
+{
+    uint64_t capabilities;
+    int32_t room;
+    int32_t health;
+    int32_t strength;
+} SolverState;
+
+typedef struct Node
+{
+    SolverState state;
+    uint32_t parent;  // Node index of the state this one was reached from
+    uint16_t command; // SolverCommand
+    uint16_t argument;
+} Node;
+
+// New states found by one worker during a level
+typedef struct Buffer
+{
+    Node *nodes;
+    size_t count;
+    size_t capacity;
+    int failed; // Out of memory
+} Buffer;
+
+typedef struct Solver
+{
+    const Dungeon *dungeon;
+    int8_t *killBit;    // Per room, capability bit of killing its creature
+    int8_t *itemBit;    // Per dungeon item, capability bit of carrying it
+    uint64_t itemMask;  // Capability bits that are items
+    int strengthCap;    // Strength beyond which no fight changes
+    int goal;
+    int maxBranch;      // Most successors a state can have
+
+    Node *nodes;        // All states found, level after level
+    size_t nodeCount;
+    size_t nodeCapacity;
+
+    uint64_t *visited;  // Fingerprints, 0 marks an empty slot
+    size_t visitedCapacity;
+    size_t visitedCount;
+
+    Buffer *buffers;    // One per worker
+    ThreadPool *pool;
+
+    pthread_mutex_t winLock;
+    int won;
+    uint32_t winParent;
+    uint16_t winCommand;
+    uint16_t winArgument;
+} Solver;
+
+typedef struct Split
+{
+    Solver *solver;
+    size_t first;
+    size_t count;
+} Split;
+
+static uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static uint64_t fingerprint(const SolverState *state)
+{
+    uint64_t hash = mix(state->capabilities + 0x9e3779b97f4a7c15ull);
+    hash = mix(hash ^ (uint32_t)state->room);
+    hash = mix(hash ^ ((uint64_t)(uint32_t)state->health << 32 | (uint32_t)state->strength));
+    return hash ? hash : 1;
+}
+
+// Add a fingerprint to the shared set, returns 1 if it was new
+static int visit(Solver *solver, uint64_t key)
+{
+    size_t mask = solver->visitedCapacity - 1;
+    size_t slot = key & mask;
+    for (;;)
+    {
+        uint64_t current = __atomic_load_n(&solver->visited[slot], __ATOMIC_ACQUIRE);
+        if (current == key)
+            return 0;
+        if (current == 0)
+        {
+            if (__atomic_compare_exchange_n(&solver->visited[slot], &current, key, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return 1;
+            if (current == key)
+                return 0;
+            continue; // Another worker took the slot, look at it again
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+// Make sure the set stays at most half full however many states the
+// coming level adds. Runs between levels, when no worker is active.
+static int reserveVisited(Solver *solver, size_t adding)
+{
+    size_t needed = 2 * (solver->visitedCount + adding);
+    if (needed <= solver->visitedCapacity)
+        return 0;
+    size_t capacity = solver->visitedCapacity ? solver->visitedCapacity : 1024;
+    while (capacity < needed)
+        capacity *= 2;
+
+    uint64_t *old = solver->visited;
+    size_t oldCapacity = solver->visitedCapacity;
+    solver->visited = calloc(capacity, sizeof(uint64_t));
+    if (!solver->visited)
+    {
+        solver->visited = old;
+        return -1;
+    }
+    solver->visitedCapacity = capacity;
+    for (size_t i = 0; i < oldCapacity; i++)
+    {
+        if (old[i])
+            visit(solver, old[i]);
+    }
+    free(old);
+    return 0;
+}
+
+static void push(Solver *solver, Buffer *buffer, const SolverState *state, uint32_t parent, int command, int argument)
+{
+    if (!visit(solver, fingerprint(state)))
+        return;
+    if (buffer->count == buffer->capacity)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        Node *nodes = realloc(buffer->nodes, sizeof(Node) * capacity);
+        if (!nodes)
+        {
+            buffer->failed = 1;
+            return;
+        }
+        buffer->nodes = nodes;
+        buffer->capacity = capacity;
+    }
+    Node *node = &buffer->nodes[buffer->count++];
+    node->state = *state;
+    node->parent = parent;
+    node->command = (uint16_t)command;
+    node->argument = (uint16_t)argument;
+}
+
+// Remember a winning command. Of several found in the same level the one
+// with the lowest parent index is kept.
+static void recordWin(Solver *solver, uint32_t parent, int command, int argument)
+{
+    pthread_mutex_lock(&solver->winLock);
+    if (!solver->won || parent < solver->winParent)
+    {
+        solver->won = 1;
+        solver->winParent = parent;
+        solver->winCommand = (uint16_t)command;
+        solver->winArgument = (uint16_t)argument;
+    }
+    pthread_mutex_unlock(&solver->winLock);
+}
+
+// All states one command away, following the same rules as the game
+static void expand(Solver *solver, uint32_t index, Buffer *buffer)
+{
+    const Dungeon *dungeon = solver->dungeon;
+    const SolverState state = solver->nodes[index].state;
+    const DungeonRoom *room = &dungeon->rooms[state.room];
+
+    for (int d = 0; d < DIR_COUNT; d++)
+    {
+        int32_t to = room->exits[d];
+        if (to < 0 || to >= dungeon->roomCount)
+            continue;
+        SolverState next = state;
+        const DungeonGate *gate = dungeonExitGate(dungeon, state.room, d);
+        if (gate)
+        {
+            if (!((state.capabilities >> gate->requirement) & 1))
+                continue;
+            next.strength += gate->strengthBonus;
+            if (next.strength > solver->strengthCap)
+                next.strength = solver->strengthCap;
+        }
+        next.room = to;
+        push(solver, buffer, &next, index, COMMAND_MOVE, d);
+    }
+
+    int carried = __builtin_popcountll(state.capabilities & solver->itemMask);
+    for (int slot = 0; slot < dungeonRoomItemCount(room) && carried < INVENTORY_CAPACITY; slot++)
+    {
+        int item = dungeonRoomItem(dungeon, room, slot);
+        if (item < 0 || item >= dungeon->itemCount || solver->itemBit[item] == NO_BIT ||
+            ((state.capabilities >> solver->itemBit[item]) & 1))
+            continue;
+        SolverState next = state;
+        next.capabilities |= 1ull << solver->itemBit[item];
+        push(solver, buffer, &next, index, COMMAND_PICKUP, item);
+    }
+
+    int killBit = solver->killBit[state.room];
+    int isGoal = state.room == solver->goal;
+    if (room->creature != 0 && room->creatureHealth > 0 &&
+        (isGoal || (killBit != NO_BIT && !((state.capabilities >> killBit) & 1))))
+    {
+        CombatResult fight = combatResolve(state.health, state.strength, room->creatureHealth, CREATURE_DAMAGE);
+        if (!fight.playerWon)
+            return;
+        if (isGoal)
+        {
+            recordWin(solver, index, COMMAND_ATTACK, 0);
+            return;
+        }
+        SolverState next = state;
+        next.capabilities |= 1ull << killBit;
+        next.health = fight.playerHealth;
+        push(solver, buffer, &next, index, COMMAND_ATTACK, 0);
+    }
+}
+
+// Fork/join over the level, as in sim.c
+static void runSplit(void *argument, int worker)
+{
+    Split *split = argument;
+    Solver *solver = split->solver;
+    while (split->count > CHUNK_STATES)
+    {
+        Split *half = malloc(sizeof(Split));
+        if (!half)
+            break;
+        half->solver = solver;
+        half->count = split->count / 2;
+        half->first = split->first + split->count - half->count;
+        split->count -= half->count;
+        threadPoolSubmit(solver->pool, runSplit, half);
+    }
+    for (size_t i = split->first; i < split->first + split->count; i++)
+        expand(solver, (uint32_t)i, &solver->buffers[worker]);
+    free(split);
+}
+
+// Move the states the workers found to the end of the node array
+static int collectLevel(Solver *solver, int workers)
+{
+    size_t added = 0;
+    for (int w = 0; w < workers; w++)
+    {
+        if (solver->buffers[w].failed)
+            return -1;
+        added += solver->buffers[w].count;
+    }
+    if (solver->nodeCount + added > UINT32_MAX)
+        return -1;
+    if (solver->nodeCount + added > solver->nodeCapacity)
+    {
+        size_t capacity = solver->nodeCapacity ? solver->nodeCapacity : 4096;
+        while (capacity < solver->nodeCount + added)
+            capacity *= 2;
+        Node *nodes = realloc(solver->nodes, sizeof(Node) * capacity);
+        if (!nodes)
+            return -1;
+        solver->nodes = nodes;
+        solver->nodeCapacity = capacity;
+    }
+    for (int w = 0; w < workers; w++)
+    {
+        memcpy(solver->nodes + solver->nodeCount, solver->buffers[w].nodes, sizeof(Node) * solver->buffers[w].count);
+        solver->nodeCount += solver->buffers[w].count;
+        solver->buffers[w].count = 0;
+    }
+    solver->visitedCount = solver->nodeCount;
+    return 0;
+}
+
+// Index the requirements: which rooms and items are worth a command
+static int prepare(Solver *solver, const Dungeon *dungeon)
+{
+    solver->dungeon = dungeon;
+    solver->goal = dungeon->header->goalRoom;
+    solver->killBit = malloc((size_t)dungeon->roomCount);
+    solver->itemBit = malloc((size_t)dungeon->itemCount + 1);
+    if (!solver->killBit || !solver->itemBit)
+        return -1;
+    memset(solver->killBit, NO_BIT, (size_t)dungeon->roomCount);
+    memset(solver->itemBit, NO_BIT, (size_t)dungeon->itemCount + 1);
+
+    int maxItems = 0;
+    solver->strengthCap = PLAYER_STRENGTH;
+    for (int i = 0; i < dungeon->requirementCount; i++)
+    {
+        const DungeonRequirement *requirement = &dungeon->requirements[i];
+        if (requirement->kind == REQUIRE_ITEM && requirement->value < (uint32_t)dungeon->itemCount)
+        {
+            solver->itemBit[requirement->value] = (int8_t)i;
+            solver->itemMask |= 1ull << i;
+            maxItems++;
+        }
+        else if (requirement->kind == REQUIRE_KILL && requirement->value < (uint32_t)dungeon->roomCount)
+        {
+            solver->killBit[requirement->value] = (int8_t)i;
+            if (dungeon->rooms[requirement->value].creatureHealth > solver->strengthCap)
+                solver->strengthCap = dungeon->rooms[requirement->value].creatureHealth;
+        }
+    }
+    if (dungeon->rooms[solver->goal].creatureHealth > solver->strengthCap)
+        solver->strengthCap = dungeon->rooms[solver->goal].creatureHealth;
+    solver->maxBranch = DIR_COUNT + maxItems + 1;
+    return 0;
+}
+
+static const char *commandText(const Solver *solver, const Node *step, char *buffer, size_t size)
+{
+    if (step->command == COMMAND_MOVE)
+        snprintf(buffer, size, "move %s", directionName(step->argument));
+    else if (step->command == COMMAND_PICKUP)
+        snprintf(buffer, size, "pickup %s", dungeonItemName(solver->dungeon, step->argument));
+    else
+        snprintf(buffer, size, "attack");
+    return buffer;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dungeonPath = DEFAULT_DUNGEON;
+    const char *logPath = NULL;
+    int threads = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            logPath = argv[++i];
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Usage: %s [-t threads] [-o log-file] [dungeon-file]\n", argv[0]);
+            return 1;
+        }
+        else
+            dungeonPath = argv[i];
+    }
+
+    Dungeon dungeon;
+    if (dungeonOpen(&dungeon, dungeonPath) != 0)
+        return 1;
+    if (dungeon.header->goalRoom < 0 || dungeon.header->goalRoom >= dungeon.roomCount ||
+        dungeon.rooms[dungeon.header->goalRoom].creature == 0)
+    {
+        fprintf(stderr, "%s has no goal creature to defeat.\n", dungeonPath);
+        return 1;
+    }
+
+    Solver solver;
+    memset(&solver, 0, sizeof(solver));
+    pthread_mutex_init(&solver.winLock, NULL);
+    solver.pool = threadPoolCreate(threads);
+    int workers = solver.pool ? threadPoolSize(solver.pool) : 0;
+    solver.buffers = calloc((size_t)workers + 1, sizeof(Buffer));
+    if (!solver.pool || !solver.buffers || prepare(&solver, &dungeon) != 0)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    // The start of a new game
+    Buffer *first = &solver.buffers[0];
+    SolverState start = {0, dungeon.header->startRoom, PLAYER_HEALTH, PLAYER_STRENGTH};
+    if (start.strength > solver.strengthCap)
+        start.strength = solver.strengthCap;
+    if (reserveVisited(&solver, 1) != 0)
+        return 1;
+    push(&solver, first, &start, 0, COMMAND_ATTACK, 0);
+    first->nodes[0].parent = UINT32_MAX;
+    if (collectLevel(&solver, workers) != 0)
+        return 1;
+
+    double started = now();
+    int levels = 0;
+    size_t levelStart = 0;
+    while (!solver.won && levelStart < solver.nodeCount)
+    {
+        size_t levelEnd = solver.nodeCount;
+        if (reserveVisited(&solver, (levelEnd - levelStart) * (size_t)solver.maxBranch) != 0)
+        {
+            fprintf(stderr, "Out of memory after %zu states.\n", solver.nodeCount);
+            return 1;
+        }
+
+        Split *split = malloc(sizeof(Split));
+        if (!split)
+            return 1;
+        split->solver = &solver;
+        split->first = levelStart;
+        split->count = levelEnd - levelStart;
+        threadPoolSubmit(solver.pool, runSplit, split);
+        threadPoolWait(solver.pool);
+        levels++;
+
+        if (collectLevel(&solver, workers) != 0)
+        {
+            fprintf(stderr, "Out of memory after %zu states.\n", solver.nodeCount);
+            return 1;
+        }
+        levelStart = levelEnd;
+    }
+    double elapsed = now() - started;
+
+    printf("%s: %zu states explored in %.3f s with %d threads (%.0f states/sec)\n",
+           dungeonPath, solver.nodeCount, elapsed, workers, elapsed > 0 ? solver.nodeCount / elapsed : 0.0);
+
+    int result = 2;
+    if (!solver.won)
+        printf("The dungeon cannot be won.\n");
+    else
+    {
+        // Walk back from the winning command to the start
+        Node last;
+        memset(&last, 0, sizeof(last));
+        last.parent = solver.winParent;
+        last.command = solver.winCommand;
+        last.argument = solver.winArgument;
+        Node **steps = malloc(sizeof(Node *) * ((size_t)levels + 1));
+        int length = 0;
+        for (const Node *step = &last; steps && step->parent != UINT32_MAX; step = &solver.nodes[step->parent])
+            steps[length++] = (Node *)step;
+
+        FILE *log = logPath ? fopen(logPath, "w") : NULL;
+        if (logPath && !log)
+            fprintf(stderr, "Error opening %s.\n", logPath);
+        printf("Winnable in %d commands:\n", length);
+        char text[128];
+        for (int i = length - 1; i >= 0; i--)
+        {
+            commandText(&solver, steps[i], text, sizeof(text));
+            printf("  %s\n", text);
+            if (log)
+                fprintf(log, "%s\n", text);
+        }
+        if (log)
+            fclose(log);
+        free(steps);
+        result = 0;
+    }
+
+    threadPoolDestroy(solver.pool);
+    for (int w = 0; w <= workers; w++)
+        free(solver.buffers[w].nodes);
+    free(solver.buffers);
+    free(solver.nodes);
+    free(solver.visited);
+    free(solver.killBit);
+    free(solver.itemBit);
+    dungeonClose(&dungeon);
+    return result;
+}
@@ -0,0 +1,45 @@
+#include <stdlib.h>
+#include <string.h>
+#include "spsc.h"
+#include "stats.h"
+
+int spscInit(SpscQueue *queue, uint32_t capacity)
+{
+    memset(queue, 0, sizeof(*queue));
+    uint32_t size = 1;
+    while (size < capacity)
+        size *= 2;
+    queue->slots = statsMalloc(sizeof(void *) * size);
+    if (!queue->slots)
+        return -1;
+    queue->mask = size - 1;
+    return 0;
+}
+
+void spscFree(SpscQueue *queue)
+{
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+int spscPush(SpscQueue *queue, void *item)
+{
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail - head > queue->mask)
+        return -1;
+    queue->slots[tail & queue->mask] = item;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *spscPop(SpscQueue *queue)
+{
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return NULL;
+    void *item = queue->slots[head & queue->mask];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
@@ -0,0 +1,36 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdint.h>
+
+// Bounded single-producer single-consumer queue of pointers. One thread
+// pushes and one other thread pops, without locks: each side only writes
+// its own index and publishes it with release ordering, and reads the
+// other's with acquire ordering, so an item is complete before it can be
+// popped. The two indices sit on cache lines of their own, so producer and
+// consumer only share a line when the queue is nearly empty or full.
+
+#define SPSC_LINE 64 // Cache line size
+
+typedef struct SpscQueue
+{
+    uint32_t head; // Next slot to pop, written by the consumer only
+    char headPad[SPSC_LINE - sizeof(uint32_t)];
+    uint32_t tail; // Next slot to push, written by the producer only
+    char tailPad[SPSC_LINE - sizeof(uint32_t)];
+    void **slots;
+    uint32_t mask; // Capacity - 1, the capacity being a power of two
+} SpscQueue;
+
+// Prepare a queue for at least capacity items. Returns 0 on success, -1 if
+// memory runs out.
+int spscInit(SpscQueue *queue, uint32_t capacity);
+void spscFree(SpscQueue *queue);
+
+// Producer side: add an item, returns -1 if the queue is full
+int spscPush(SpscQueue *queue, void *item);
+
+// Consumer side: take the oldest item, NULL if the queue is empty
+void *spscPop(SpscQueue *queue);
+
+#endif // SPSC_H
@@ -0,0 +1,192 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+#ifdef GAME_STATS
+
+typedef struct CommandStats
+{
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t allocations;
+    uint64_t bytes;
+    uint64_t histogram[STATS_BUCKETS];
+} CommandStats;
+
+static CommandStats table[CMD_KIND_COUNT];
+
+// The command running on this thread, if any
+static __thread int running;
+static __thread int runningKind;
+static __thread uint64_t runningStart;
+static __thread uint64_t runningAllocations;
+static __thread uint64_t runningBytes;
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int bucketOf(uint64_t ns)
+{
+    int bucket = 0;
+    while (ns > 1 && bucket < STATS_BUCKETS - 1)
+    {
+        ns >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void statsCommandBegin(int kind)
+{
+    running = 1;
+    runningKind = kind;
+    runningAllocations = 0;
+    runningBytes = 0;
+    runningStart = nowNs();
+}
+
+void statsCommandEnd(void)
+{
+    if (!running)
+        return;
+    uint64_t ns = nowNs() - runningStart;
+    running = 0;
+
+    // The server's shards finish commands on several threads at once
+    CommandStats *stats = &table[runningKind];
+    __atomic_add_fetch(&stats->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->totalNs, ns, __ATOMIC_RELAXED);
+    uint64_t maxNs = __atomic_load_n(&stats->maxNs, __ATOMIC_RELAXED);
+    while (ns > maxNs && !__atomic_compare_exchange_n(&stats->maxNs, &maxNs, ns, 0,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    __atomic_add_fetch(&stats->allocations, runningAllocations, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->bytes, runningBytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->histogram[bucketOf(ns)], 1, __ATOMIC_RELAXED);
+}
+
+static void countAllocation(const void *pointer, size_t bytes)
+{
+    if (!running || !pointer)
+        return;
+    runningAllocations++;
+    runningBytes += bytes;
+}
+
+void *statsMalloc(size_t bytes)
+{
+    void *pointer = malloc(bytes);
+    countAllocation(pointer, bytes);
+    return pointer;
+}
+
+void *statsCalloc(size_t count, size_t size)
+{
+    void *pointer = calloc(count, size);
+    countAllocation(pointer, count * size);
+    return pointer;
+}
+
+void *statsRealloc(void *pointer, size_t bytes)
+{
+    void *grown = realloc(pointer, bytes);
+    countAllocation(grown, bytes);
+    return grown;
+}
+
+char *statsStrdup(const char *text)
+{
+    char *copy = strdup(text);
+    countAllocation(copy, copy ? strlen(copy) + 1 : 0);
+    return copy;
+}
+
+// Upper end of the bucket that holds the given fraction of the commands,
+// but no more than the slowest command
+static uint64_t percentileNs(const CommandStats *stats, double fraction)
+{
+    uint64_t rank = (uint64_t)(fraction * (double)stats->count);
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += stats->histogram[i];
+        if (seen > rank)
+            return (2ull << i) < stats->maxNs ? 2ull << i : stats->maxNs;
+    }
+    return stats->maxNs;
+}
+
+void statsPrint(OutputSink *out)
+{
+    sinkPrintf(out, "%-10s %8s %10s %10s %10s %10s %11s %11s\n",
+               "command", "count", "mean us", "p50 us", "p99 us", "max us", "allocs/cmd", "bytes/cmd");
+    for (int kind = 0; kind < CMD_KIND_COUNT; kind++)
+    {
+        const CommandStats *stats = &table[kind];
+        if (stats->count == 0)
+            continue;
+        double count = (double)stats->count;
+        sinkPrintf(out, "%-10s %8llu %10.2f %10.2f %10.2f %10.2f %11.2f %11.1f\n",
+                   commandKindName(kind), (unsigned long long)stats->count,
+                   stats->totalNs / count / 1e3, percentileNs(stats, 0.5) / 1e3,
+                   percentileNs(stats, 0.99) / 1e3, stats->maxNs / 1e3,
+                   stats->allocations / count, stats->bytes / count);
+    }
+    sinkPrintf(out, "Percentiles are rounded up to a power of two nanoseconds.\n");
+}
+
+int statsWrite(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return -1;
+    fprintf(file, "{\"buckets\": \"histogram bucket i counts latencies in [2^i, 2^(i+1)) ns\", \"commands\": [");
+    int first = 1;
+    for (int kind = 0; kind < CMD_KIND_COUNT; kind++)
+    {
+        const CommandStats *stats = &table[kind];
+        if (stats->count == 0)
+            continue;
+        fprintf(file, "%s\n  {\"name\": \"%s\", \"count\": %llu, \"totalNs\": %llu, \"maxNs\": %llu, "
+                      "\"allocations\": %llu, \"bytes\": %llu, \"histogram\": [",
+                first ? "" : ",", commandKindName(kind), (unsigned long long)stats->count,
+                (unsigned long long)stats->totalNs, (unsigned long long)stats->maxNs,
+                (unsigned long long)stats->allocations, (unsigned long long)stats->bytes);
+        for (int i = 0; i < STATS_BUCKETS; i++)
+            fprintf(file, "%s%llu", i ? ", " : "", (unsigned long long)stats->histogram[i]);
+        fprintf(file, "]}");
+        first = 0;
+    }
+    fprintf(file, "\n]}\n");
+    if (ferror(file) | fclose(file))
+        return -1;
+    return 0;
+}
+
+void statsWriteOnExit(void)
+{
+    const char *path = getenv(STATS_FILE_VARIABLE);
+    if (path && *path && statsWrite(path) != 0)
+        fprintf(stderr, "Error writing statistics to %s.\n", path);
+}
+
+#endif // GAME_STATS
+
+void *statsAlignedAlloc(size_t alignment, size_t bytes)
+{
+    void *pointer;
+    if (posix_memalign(&pointer, alignment, bytes) != 0)
+        return NULL;
+#ifdef GAME_STATS
+    countAllocation(pointer, bytes);
+#endif
+    return pointer;
+}
@@ -0,0 +1,72 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "command.h"
+#include "output.h"
+
+// Per-command instrumentation. Built with -DGAME_STATS, every command
+// handled records its latency in a log2 histogram of nanoseconds for its
+// kind, together with the heap allocations (and their bytes) made while it
+// ran. The engine allocates only through statsMalloc and its siblings,
+// which count what they allocate. The stats command shows the tables, and when GAME_STATS_FILE is set
+// in the environment they are written there as JSON on exit.
+//
+// Without GAME_STATS the STATS_ macros expand to nothing and the allocation
+// wrappers to the C library functions, so the game pays nothing for the
+// instrumentation.
+//
+// Commands are timed on the thread that handles them, and threads add to
+// the shared tables atomically. Allocations are only counted on that thread
+// while a command runs.
+
+#define STATS_BUCKETS 40 // Bucket i counts latencies in [2^i, 2^(i+1)) ns
+#define STATS_FILE_VARIABLE "GAME_STATS_FILE"
+
+// posix_memalign as a function returning the block, NULL on failure. The
+// allocation is counted like those of statsMalloc.
+void *statsAlignedAlloc(size_t alignment, size_t bytes);
+
+#ifdef GAME_STATS
+
+// Start and finish timing a command of the given kind
+void statsCommandBegin(int kind);
+void statsCommandEnd(void);
+
+// malloc, calloc, realloc and strdup, counting the allocation against the
+// running command. A realloc counts as an allocation of its new size.
+void *statsMalloc(size_t bytes);
+void *statsCalloc(size_t count, size_t size);
+void *statsRealloc(void *pointer, size_t bytes);
+char *statsStrdup(const char *text);
+
+// Print the tables of every command kind seen so far
+void statsPrint(OutputSink *out);
+
+// Write the tables as JSON. Returns 0 on success, -1 on error.
+int statsWrite(const char *path);
+
+// Write the tables to $GAME_STATS_FILE if it is set
+void statsWriteOnExit(void);
+
+#define STATS_BEGIN(kind) statsCommandBegin(kind)
+#define STATS_END() statsCommandEnd()
+#define STATS_EXIT() statsWriteOnExit()
+
+#else
+
+#define STATS_BEGIN(kind) ((void)0)
+#define STATS_END() ((void)0)
+#define STATS_EXIT() ((void)0)
+
+#define statsMalloc(bytes) malloc(bytes)
+#define statsCalloc(count, size) calloc(count, size)
+#define statsRealloc(pointer, bytes) realloc(pointer, bytes)
+#define statsStrdup(text) strdup(text)
+
+#endif // GAME_STATS
+
+#endif // STATS_H
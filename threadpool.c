@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "threadpool.h"
+#include "stats.h"
+
+#define DEQUE_INITIAL_CAPACITY 64
+
+typedef struct Task
+{
+    TaskFunction function;
+    void *argument;
+} Task;
+
+// Ring buffer deque. Each has its own lock, so the owner and thieves only
+// contend when they touch the same deque.
+typedef struct Deque
+{
+    pthread_mutex_t lock;
+    Task *tasks;
+    size_t capacity; // Power of two
+    size_t top;      // Next task to steal
+    size_t bottom;   // One past the owner's newest task
+} Deque;
+
+typedef struct Worker
+{
+    ThreadPool *pool;
+    int index;
+    pthread_t thread;
+    Deque deque;
+    unsigned random; // Victim selection
+} Worker;
+
+struct ThreadPool
+{
+    Worker *workers;
+    int workerCount;
+    long queued;  // Tasks sitting in deques (atomic)
+    long pending; // Tasks submitted but not finished (atomic)
+    unsigned nextDeque;
+
+    pthread_mutex_t lock;
+    pthread_cond_t workAvailable;
+    pthread_cond_t allDone;
+    int stopping;
+};
+
+static __thread Worker *currentWorker;
+
+static void dequePush(Deque *deque, Task task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity)
+    {
+        size_t capacity = deque->capacity * 2;
+        Task *tasks = statsMalloc(sizeof(Task) * capacity);
+        for (size_t i = deque->top; i != deque->bottom; i++)
+            tasks[i & (capacity - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->bottom & (deque->capacity - 1)] = task;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// Owner end: newest task first, keeps the working set hot in cache
+static int dequePop(Deque *deque, Task *task)
+{
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top)
+    {
+        deque->bottom--;
+        *task = deque->tasks[deque->bottom & (deque->capacity - 1)];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Thief end: oldest task first, which tends to be the biggest piece of work
+static int dequeSteal(Deque *deque, Task *task)
+{
+    int found = 0;
+    if (pthread_mutex_trylock(&deque->lock) != 0)
+        return 0;
+    if (deque->bottom != deque->top)
+    {
+        *task = deque->tasks[deque->top & (deque->capacity - 1)];
+        deque->top++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int findTask(Worker *worker, Task *task)
+{
+    ThreadPool *pool = worker->pool;
+    if (dequePop(&worker->deque, task))
+        return 1;
+
+    // Try every other worker once, starting at a random victim
+    worker->random = worker->random * 1103515245u + 12345u;
+    int start = (int)((worker->random >> 16) % (unsigned)pool->workerCount);
+    for (int i = 0; i < pool->workerCount; i++)
+    {
+        Worker *victim = &pool->workers[(start + i) % pool->workerCount];
+        if (victim != worker && dequeSteal(&victim->deque, task))
+            return 1;
+    }
+    return 0;
+}
+
+static void *workerMain(void *argument)
+{
+    Worker *worker = argument;
+    ThreadPool *pool = worker->pool;
+    currentWorker = worker;
+
+    for (;;)
+    {
+        Task task;
+        if (findTask(worker, &task))
+        {
+            __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+            task.function(task.argument, worker->index);
+            if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0)
+            {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->allDone);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+
+        // Nothing to run or steal: sleep until a task is queued. A failed
+        // trylock in dequeSteal can miss a task, so re-check the counter.
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stopping && __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0)
+            pthread_cond_wait(&pool->workAvailable, &pool->lock);
+        int stop = pool->stopping && __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+ThreadPool *threadPoolCreate(int threads)
+{
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    ThreadPool *pool = statsCalloc(1, sizeof(ThreadPool));
+    if (!pool)
+        return NULL;
+    pool->workers = statsCalloc((size_t)threads, sizeof(Worker));
+    if (!pool->workers)
+    {
+        free(pool);
+        return NULL;
+    }
+    pool->workerCount = threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workAvailable, NULL);
+    pthread_cond_init(&pool->allDone, NULL);
+
+    for (int i = 0; i < threads; i++)
+    {
+        Worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->random = (unsigned)i * 2654435761u + 1;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        worker->deque.capacity = DEQUE_INITIAL_CAPACITY;
+        worker->deque.tasks = statsMalloc(sizeof(Task) * DEQUE_INITIAL_CAPACITY);
+    }
+    for (int i = 0; i < threads; i++)
+        pthread_create(&pool->workers[i].thread, NULL, workerMain, &pool->workers[i]);
+    return pool;
+}
+
+int threadPoolSize(const ThreadPool *pool)
+{
+    return pool->workerCount;
+}
+
+void threadPoolSubmit(ThreadPool *pool, TaskFunction function, void *argument)
+{
+    Task task;
+    task.function = function;
+    task.argument = argument;
+
+    Worker *worker = currentWorker;
+    if (!worker || worker->pool != pool)
+    {
+        unsigned next = __atomic_fetch_add(&pool->nextDeque, 1, __ATOMIC_RELAXED);
+        worker = &pool->workers[next % (unsigned)pool->workerCount];
+    }
+
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    dequePush(&worker->deque, task);
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadPoolWait(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) != 0)
+        pthread_cond_wait(&pool->allDone, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadPoolDestroy(ThreadPool *pool)
+{
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->workerCount; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+    for (int i = 0; i < pool->workerCount; i++)
+    {
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        free(pool->workers[i].deque.tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->workAvailable);
+    pthread_cond_destroy(&pool->allDone);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,31 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// Work-stealing thread pool. Every worker owns a deque: it pushes and pops
+// its own tasks at the bottom and, when it runs dry, steals from the top of
+// another worker's deque. Tasks may submit more tasks, which is how large
+// jobs are split recursively across all cores.
+
+typedef struct ThreadPool ThreadPool;
+
+// A task receives its argument and the index of the worker running it
+typedef void (*TaskFunction)(void *argument, int worker);
+
+// Start a pool, threads <= 0 uses one worker per online CPU
+ThreadPool *threadPoolCreate(int threads);
+
+// Number of workers
+int threadPoolSize(const ThreadPool *pool);
+
+// Queue a task. Called from a worker the task goes to that worker's own
+// deque, otherwise the deques are filled round-robin.
+void threadPoolSubmit(ThreadPool *pool, TaskFunction function, void *argument);
+
+// Block until every submitted task, including ones submitted by tasks,
+// has finished
+void threadPoolWait(ThreadPool *pool);
+
+// Stop the workers and free the pool. Pending tasks are finished first.
+void threadPoolDestroy(ThreadPool *pool);
+
+#endif // THREADPOOL_H